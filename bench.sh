@@ -0,0 +1,56 @@
+#!/bin/sh
+# Scalability sweep over the collatz drivers.
+#
+# Runs every collatz-{list,ulist,ivec}-{sys,hw7,par} binary once per thread count,
+# REPEATS times each, and prints the best iterate-phase time with the
+# speedup over the first thread count in the sweep.
+#
+# Usage: ./bench.sh [TOP [REPEATS [THREADS...]]]
+#   e.g. ./bench.sh 1000 3 1 2 4 8 16 32
+
+TOP=${1:-1000}
+REPEATS=${2:-3}
+if [ $# -gt 2 ]; then
+    shift 2
+    THREADS="$*"
+else
+    THREADS="1 2 4 8"
+fi
+
+BINS="collatz-list-sys collatz-list-hw7 collatz-list-par
+      collatz-ulist-sys collatz-ulist-hw7 collatz-ulist-par
+      collatz-ivec-sys collatz-ivec-hw7 collatz-ivec-par"
+
+printf "%-18s %8s %12s %12s %12s %8s\n" binary threads setup iterate teardown speedup
+
+for bin in $BINS; do
+    if [ ! -x "./$bin" ]; then
+        echo "$bin: not built, run make first" >&2
+        exit 1
+    fi
+
+    base=""
+    for nn in $THREADS; do
+        # keep the fastest repeat of each phase; slower ones are noise
+        line=$(./$bin "$TOP" "$nn" "$REPEATS" | awk '
+            /^result / {
+                for (ii = 2; ii <= NF; ++ii) {
+                    split($ii, kv, "=")
+                    if (kv[1] == "setup" || kv[1] == "iterate" || kv[1] == "teardown") {
+                        if (!(kv[1] in best) || kv[2] < best[kv[1]]) {
+                            best[kv[1]] = kv[2]
+                        }
+                    }
+                }
+            }
+            END { printf "%f %f %f\n", best["setup"], best["iterate"], best["teardown"] }')
+
+        set -- $line
+        if [ -z "$base" ]; then
+            base=$2
+        fi
+
+        printf "%-18s %8d %12s %12s %12s %8.2f\n" "$bin" "$nn" "$1" "$2" "$3" \
+            "$(awk -v b="$base" -v t="$2" 'BEGIN { print (t > 0) ? b / t : 0 }')"
+    done
+done
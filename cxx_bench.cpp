@@ -0,0 +1,152 @@
+
+// Container churn benchmark for the C++ allocator adapter.
+//
+// Each thread repeatedly builds and tears down a std::vector, std::list and
+// std::unordered_map, once with std::allocator (plain new/delete, which
+// xnew.o routes to xmalloc) and once with hmalloc::allocator (xmalloc with
+// sized frees). Prints one result line per container and allocator.
+//
+// Usage: cxxbench-{sys,hw7,par} ROUNDS [THREADS]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+
+#include "hmalloc_allocator.hpp"
+
+// elements per container per round
+static const long ELEMS = 10000;
+
+static long rounds = 0;
+static volatile long sink = 0;
+
+static double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <template <class> class Alloc>
+static void
+churn_vector()
+{
+    for (long rr = 0; rr < rounds; ++rr) {
+        // grown one element at a time, so every doubling reallocates
+        std::vector<long, Alloc<long>> xs;
+        for (long ii = 0; ii < ELEMS; ++ii) {
+            xs.push_back(ii);
+        }
+        // plus many short vectors of varying length
+        for (long ii = 0; ii < ELEMS / 10; ++ii) {
+            std::vector<long, Alloc<long>> ys(ii % 97 + 1, ii);
+            sink += ys.back();
+        }
+        sink += xs.back();
+    }
+}
+
+template <template <class> class Alloc>
+static void
+churn_list()
+{
+    for (long rr = 0; rr < rounds; ++rr) {
+        std::list<long, Alloc<long>> xs;
+        for (long ii = 0; ii < ELEMS; ++ii) {
+            xs.push_back(ii);
+        }
+        // drop every other node and refill, interleaving frees and allocations
+        for (auto it = xs.begin(); it != xs.end(); ) {
+            it = xs.erase(it);
+            if (it != xs.end()) {
+                ++it;
+            }
+        }
+        for (long ii = 0; ii < ELEMS / 2; ++ii) {
+            xs.push_front(ii);
+        }
+        sink += xs.size();
+    }
+}
+
+template <template <class> class Alloc>
+static void
+churn_map()
+{
+    typedef std::pair<const long, long> entry;
+    for (long rr = 0; rr < rounds; ++rr) {
+        std::unordered_map<long, long, std::hash<long>, std::equal_to<long>, Alloc<entry>> mm;
+        for (long ii = 0; ii < ELEMS; ++ii) {
+            mm[ii * 7919] = ii;
+        }
+        for (long ii = 0; ii < ELEMS; ii += 2) {
+            mm.erase(ii * 7919);
+        }
+        sink += mm.size();
+    }
+}
+
+struct bench_case {
+    const char* container;
+    const char* alloc;
+    void (*run)();
+};
+
+static const bench_case cases[] = {
+    { "vector",        "std",     churn_vector<std::allocator> },
+    { "vector",        "hmalloc", churn_vector<hmalloc::allocator> },
+    { "list",          "std",     churn_list<std::allocator> },
+    { "list",          "hmalloc", churn_list<hmalloc::allocator> },
+    { "unordered_map", "std",     churn_map<std::allocator> },
+    { "unordered_map", "hmalloc", churn_map<hmalloc::allocator> },
+};
+
+static void*
+bench_thread(void* arg)
+{
+    ((const bench_case*)arg)->run();
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s ROUNDS [THREADS]\n", argv[0]);
+        return 1;
+    }
+    rounds = atol(argv[1]);
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    if (rounds < 1 || threads < 1) {
+        printf("ROUNDS and THREADS must be positive\n");
+        return 1;
+    }
+
+    const char* driver = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    std::vector<pthread_t> workers(threads);
+
+    for (const bench_case& bc : cases) {
+        double t0 = now_seconds();
+        for (int tt = 0; tt < threads; ++tt) {
+            pthread_create(&workers[tt], 0, bench_thread, (void*)&bc);
+        }
+        for (int tt = 0; tt < threads; ++tt) {
+            pthread_join(workers[tt], 0);
+        }
+        double t1 = now_seconds();
+
+        printf("result driver=%s container=%s alloc=%s rounds=%ld threads=%d time=%.6f\n",
+               driver, bc.container, bc.alloc, rounds, threads, t1 - t0);
+    }
+
+    return 0;
+}
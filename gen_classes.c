@@ -0,0 +1,231 @@
+
+// Generates size_classes.h for par_malloc.c from HMALLOC_PROFILE output.
+//
+// Every profiled request becomes a chunk of its own size rounded to 16, the
+// alignment par keeps every chunk at. The classes are picked from those chunk sizes by dynamic programming
+// to minimise, over all profiled allocations, the bytes lost to rounding up
+// to a class plus each chunk's share of the unusable tail of its slab.
+//
+// Usage: gen_classes [-k CLASSES] PROFILE... > size_classes.h
+// CLASSES is at most 16, the number xmalloc_fast.h dispatches on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+// These must match par_malloc.c's slab layout
+#define PAGE_SIZE 4096
+#define PAGE_HEADER 80
+#define SLAB_MAX_PAGES 16
+#define SLAB_WASTE_DIVISOR 8
+
+// the profile lumps every request over 8192 bytes together
+#define MAX_CHUNK 8192
+#define NUM_SIZES (MAX_CHUNK / 8 + 1)
+#define DEFAULT_CLASSES 10
+// xmalloc_fast.h dispatches on at most this many (XMALLOC_FAST_CLASSES)
+#define MAX_CLASSES 16
+
+// allocation counts indexed by chunk size / 8
+static double counts[NUM_SIZES];
+static long   large_count = 0;
+
+static
+long
+header_bytes(long nn)
+{
+    return (PAGE_HEADER + (nn + 63) / 64 * 8 + 15) & ~15L;
+}
+
+static
+long
+chunks_in_slab(long chunk, long slab)
+{
+    long nn = (slab - PAGE_HEADER) / chunk;
+    while (nn > 0 && header_bytes(nn) + nn * chunk > slab) {
+        nn--;
+    }
+    return nn;
+}
+
+// bytes of slab lost per chunk, for the slab par_malloc.c's slabGeometry picks
+static
+double
+page_waste(long chunk)
+{
+    double best_frac = HUGE_VAL;
+    double best = HUGE_VAL;
+    for (long pages = 1; pages <= SLAB_MAX_PAGES; pages *= 2) {
+        long slab = pages * PAGE_SIZE;
+        long nn = chunks_in_slab(chunk, slab);
+        if (nn == 0) {
+            continue;
+        }
+        long waste = slab - header_bytes(nn) - nn * chunk;
+        if (waste * SLAB_WASTE_DIVISOR <= slab) {
+            return (double)waste / nn;
+        }
+        // otherwise par keeps the slab losing the smallest fraction
+        if ((double)waste / slab < best_frac) {
+            best_frac = (double)waste / slab;
+            best = (double)waste / nn;
+        }
+    }
+    return best;
+}
+
+static
+void
+read_profile(const char* path)
+{
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        exit(1);
+    }
+
+    char word[32];
+    long count;
+    while (fscanf(in, "%31s %ld", word, &count) == 2) {
+        if (strcmp(word, "large") == 0) {
+            large_count += count;
+            continue;
+        }
+
+        long chunk = (atol(word) + 15) & ~15L;
+        if (chunk < 16) {
+            chunk = 16;
+        }
+        if (chunk > MAX_CHUNK) {
+            large_count += count;
+            continue;
+        }
+        counts[chunk / 8] += count;
+    }
+
+    fclose(in);
+}
+
+int
+main(int argc, char* argv[])
+{
+    int classes = DEFAULT_CLASSES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        if (opt == 'k') {
+            classes = atoi(optarg);
+        }
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc || classes < 1 || classes > MAX_CLASSES) {
+        fprintf(stderr, "Usage:\n\t%s [-k CLASSES] PROFILE... > size_classes.h\n", argv[0]);
+        fprintf(stderr, "\tCLASSES is 1 to %d (default %d)\n", MAX_CLASSES, DEFAULT_CLASSES);
+        return 1;
+    }
+
+    for (int ii = optind; ii < argc; ++ii) {
+        read_profile(argv[ii]);
+    }
+
+    // the distinct chunk sizes seen, with prefix sums of counts and bytes
+    long   sizes[NUM_SIZES];
+    double pre_n[NUM_SIZES + 1];
+    double pre_s[NUM_SIZES + 1];
+    int nn = 0;
+    double total = 0;
+
+    pre_n[0] = pre_s[0] = 0;
+    for (long ii = 0; ii < NUM_SIZES; ++ii) {
+        if (counts[ii] > 0) {
+            sizes[nn] = ii * 8;
+            pre_n[nn + 1] = pre_n[nn] + counts[ii];
+            pre_s[nn + 1] = pre_s[nn] + counts[ii] * ii * 8;
+            total += counts[ii];
+            nn++;
+        }
+    }
+    if (nn == 0) {
+        fprintf(stderr, "%s: no small allocations in the profile\n", argv[0]);
+        return 1;
+    }
+    if (classes > nn) {
+        classes = nn;
+    }
+
+    // cost[k][j]: least waste covering sizes[0..j] with k+1 classes, the last being sizes[j]
+    // (cost of sizes[i+1..j] served by class sizes[j] is C*N - S + N*page_waste(C))
+    double* cost = calloc((size_t)classes * nn, sizeof(double));
+    int*    from = calloc((size_t)classes * nn, sizeof(int));
+
+    for (int jj = 0; jj < nn; ++jj) {
+        double cc = sizes[jj];
+        cost[jj] = cc * pre_n[jj + 1] - pre_s[jj + 1] + pre_n[jj + 1] * page_waste(sizes[jj]);
+        from[jj] = -1;
+    }
+    for (int kk = 1; kk < classes; ++kk) {
+        for (int jj = 0; jj < nn; ++jj) {
+            double best = HUGE_VAL;
+            int    arg  = -1;
+            double cc = sizes[jj];
+            double pw = page_waste(sizes[jj]);
+
+            // the first kk sizes each need a class of their own
+            for (int ii = kk - 1; ii < jj; ++ii) {
+                double n = pre_n[jj + 1] - pre_n[ii + 1];
+                double s = pre_s[jj + 1] - pre_s[ii + 1];
+                double c = cost[(kk - 1) * nn + ii] + cc * n - s + n * pw;
+                if (c < best) {
+                    best = c;
+                    arg  = ii;
+                }
+            }
+            cost[kk * nn + jj] = best;
+            from[kk * nn + jj] = arg;
+        }
+    }
+
+    // take the cheapest class count within the budget
+    int used = 0;
+    for (int kk = 1; kk < classes; ++kk) {
+        if (cost[kk * nn + nn - 1] < cost[used * nn + nn - 1]) {
+            used = kk;
+        }
+    }
+    double waste = cost[used * nn + nn - 1];
+
+    // walk back from the largest size, which must be a class
+    long chosen[NUM_SIZES];
+    int count = 0;
+    for (int jj = nn - 1, kk = used; jj >= 0; --kk) {
+        chosen[count++] = sizes[jj];
+        jj = from[kk * nn + jj];
+    }
+
+    printf("#ifndef SIZE_CLASSES_H\n");
+    printf("#define SIZE_CLASSES_H\n\n");
+    printf("// Bucket sizes for par_malloc.c, in chunk bytes; chunks carry no header.\n");
+    printf("//\n");
+    printf("// Generated by gen_classes from %.0f profiled allocations (%ld larger than 8 KiB);\n", total, large_count);
+    printf("// expected waste is %.1f bytes per allocation. Regenerate with `make pgo`.\n\n",
+           waste / total);
+    printf("#define BUCKET_NUM_BUCKETS %d\n\n", count);
+    for (int ii = count - 1; ii >= 0; --ii) {
+        printf("#define BUCKET_CLASS_%d %ld\n", count - 1 - ii, chosen[ii]);
+    }
+    printf("\n");
+    printf("#define BUCKET_CLASS_SIZES { ");
+    for (int ii = count - 1; ii >= 0; --ii) {
+        printf("%ld%s", chosen[ii], ii ? ", " : " }\n");
+    }
+    printf("\n#endif\n");
+
+    free(cost);
+    free(from);
+    return 0;
+}
@@ -11,8 +11,12 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "hmalloc.h"
+#include "hmsnap.h"
+#include "xmalloc.h"
 
 typedef struct nu_free_cell {
     int64_t              size;
@@ -22,16 +26,74 @@ typedef struct nu_free_cell {
 static const int64_t CHUNK_SIZE = 65536;
 static const int64_t CELL_SIZE  = (int64_t)sizeof(nu_free_cell);
 
-static nu_free_cell* nu_free_list = 0;
-static pthread_mutex_t freelist_lock = PTHREAD_MUTEX_INITIALIZER;
+// Blocks are XMALLOC_ALIGNMENT (16) aligned: every cell starts 8 bytes past
+// a 16-byte boundary and is a multiple of 16 long, so the block after its
+// 8-byte header lands on one. A chunk gives up its first and last 8 bytes
+// for this; a large mapping its first 8.
+static const int64_t ALIGN_SKIP = 8;
+static const int64_t CHUNK_CELL = 65536 - 16;
+
+// Block sizes are multiples of 8, so the low bit of a free cell's size is
+// spare. It marks cells untouched since mmap, apart from the cell header.
+static const int64_t FRESH_BIT  = 1;
+
+// Each arena has its own free list and lock, carved from its own chunks.
+// Threads start on arenas round-robin and move to whichever arena they
+// last got without waiting, so contended threads spread themselves out.
+//
+// Long-lived and read-mostly allocations (see xmalloc_hint) get an arena
+// each of their own, after the per-core ones, so they never pin the chunks
+// that short-lived blocks churn through.
+#define NU_MAX_ARENAS 64
+#define NU_HINT_ARENAS 2
+#define NU_ALL_ARENAS (NU_MAX_ARENAS + NU_HINT_ARENAS)
+
+typedef struct nu_arena {
+    pthread_mutex_t lock;
+    nu_free_cell*   free_list;
+    int64_t         chunks_mapped;
+} __attribute__((aligned(64))) nu_arena;
+
+static nu_arena nu_arenas[NU_ALL_ARENAS];
+static int nu_arena_count = 0;
+static pthread_once_t nu_arena_once = PTHREAD_ONCE_INIT;
+static int nu_next_arena = 0;
+static __thread int nu_home_arena = -1;
+
+// Large blocks belong to no arena; only their totals are kept, for snapshots
+static int64_t nu_large_count = 0;
+static int64_t nu_large_bytes = 0;
+
+// A block's header word holds its size in the low 48 bits and the index of
+// the arena it was carved from above that, so hfree finds the right list.
+static const int     ARENA_SHIFT = 48;
+static const int64_t SIZE_MASK   = ((int64_t) 1 << 48) - 1;
+
+static
+void
+nu_arenas_init()
+{
+    // one arena per core unless HMALLOC_ARENAS says otherwise
+    const char* env = getenv("HMALLOC_ARENAS");
+    long cpus = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    nu_arena_count = (cpus < 1) ? 1 : (cpus > NU_MAX_ARENAS) ? NU_MAX_ARENAS : (int) cpus;
+
+    for (int ii = 0; ii < NU_ALL_ARENAS; ++ii) {
+        pthread_mutex_init(&(nu_arenas[ii].lock), 0);
+        nu_arenas[ii].free_list = 0;
+        nu_arenas[ii].chunks_mapped = 0;
+    }
+}
 
 int64_t
 nu_free_list_length()
 {
     int len = 0;
 
-    for (nu_free_cell* pp = nu_free_list; pp != 0; pp = pp->next) {
-        len++;
+    for (int ii = 0; ii < NU_ALL_ARENAS; ++ii) {
+        for (nu_free_cell* pp = nu_arenas[ii].free_list; pp != 0; pp = pp->next) {
+            len++;
+        }
     }
 
     return len;
@@ -40,43 +102,56 @@ nu_free_list_length()
 void
 nu_print_free_list()
 {
-    nu_free_cell* pp = nu_free_list;
-    printf("= Free list: =\n");
-
-    for (; pp != 0; pp = pp->next) {
-        printf("%lx: (cell %ld %lx)\n", (int64_t) pp, pp->size, (int64_t) pp->next); 
+    for (int ii = 0; ii < NU_ALL_ARENAS; ++ii) {
+        nu_free_cell* pp = nu_arenas[ii].free_list;
+        if (pp == 0) {
+            continue;
+        }
+        printf("= Free list (arena %d): =\n", ii);
 
+        for (; pp != 0; pp = pp->next) {
+            printf("%lx: (cell %ld %lx)\n", (int64_t) pp, pp->size & ~FRESH_BIT, (int64_t) pp->next); 
+        }
     }
 }
 
+// Merge cell into next if they are adjacent; returns 1 if merged.
 static
-void
-nu_free_list_coalesce()
+int
+nu_free_cell_merge(nu_free_cell* pp)
 {
-    nu_free_cell* pp = nu_free_list;
-    int free_chunk = 0;
+    nu_free_cell* next = pp->next;
+    int64_t size = pp->size & ~FRESH_BIT;
 
-    while (pp != 0 && pp->next != 0) {
-        if (((int64_t)pp) + pp->size == ((int64_t) pp->next)) {
-            pp->size += pp->next->size;
-            pp->next  = pp->next->next;
-        }
+    if (next == 0 || ((int64_t)pp) + size != ((int64_t) next)) {
+        return 0;
+    }
 
-        pp = pp->next;
+    int64_t fresh = pp->size & next->size & FRESH_BIT;
+    pp->size  = size + (next->size & ~FRESH_BIT);
+    pp->next  = next->next;
+    if (fresh) {
+        // wipe the swallowed header so the merged cell stays fresh
+        memset(next, 0, sizeof(nu_free_cell));
+        pp->size |= FRESH_BIT;
     }
+    return 1;
 }
 
+// The list is sorted by address, so a new cell can only merge with its
+// neighbours; coalescing there keeps the arena lock held for one walk.
 static
 void
-nu_free_list_insert(nu_free_cell* cell)
+nu_free_list_insert(nu_arena* arena, nu_free_cell* cell)
 {
-    if (nu_free_list == 0 || ((uint64_t) nu_free_list) > ((uint64_t) cell)) {
-        cell->next = nu_free_list;
-        nu_free_list = cell;
+    if (arena->free_list == 0 || ((uint64_t) arena->free_list) > ((uint64_t) cell)) {
+        cell->next = arena->free_list;
+        arena->free_list = cell;
+        nu_free_cell_merge(cell);
         return;
     }
 
-    nu_free_cell* pp = nu_free_list;
+    nu_free_cell* pp = arena->free_list;
 
     while (pp->next != 0 && ((uint64_t)pp->next) < ((uint64_t) cell)) {
         pp = pp->next;
@@ -85,17 +160,18 @@ nu_free_list_insert(nu_free_cell* cell)
     cell->next = pp->next;
     pp->next = cell;
 
-    nu_free_list_coalesce();
+    nu_free_cell_merge(cell);
+    nu_free_cell_merge(pp);
 }
 
 static
 nu_free_cell*
-free_list_get_cell(int64_t size)
+free_list_get_cell(nu_arena* arena, int64_t size)
 {
-    nu_free_cell** prev = &nu_free_list;
+    nu_free_cell** prev = &(arena->free_list);
 
-    for (nu_free_cell* pp = nu_free_list; pp != 0; pp = pp->next) {
-        if (pp->size >= size) {
+    for (nu_free_cell* pp = arena->free_list; pp != 0; pp = pp->next) {
+        if ((pp->size & ~FRESH_BIT) >= size) {
             *prev = pp->next;
             return pp;
         }
@@ -104,20 +180,50 @@ free_list_get_cell(int64_t size)
     return 0;
 }
 
+// Lock an arena for this thread: its home arena if free, else the first
+// other arena that can be had without waiting, which becomes the new home.
+static
+int
+nu_arena_acquire(int hint)
+{
+    pthread_once(&nu_arena_once, nu_arenas_init);
+
+    if (hint == XMALLOC_HINT_LONG_LIVED || hint == XMALLOC_HINT_READ_MOSTLY) {
+        int idx = NU_MAX_ARENAS + (hint == XMALLOC_HINT_READ_MOSTLY);
+        pthread_mutex_lock(&(nu_arenas[idx].lock));
+        return idx;
+    }
+
+    if (nu_home_arena < 0) {
+        nu_home_arena = __atomic_fetch_add(&nu_next_arena, 1, __ATOMIC_RELAXED) % nu_arena_count;
+    }
+
+    for (int ii = 0; ii < nu_arena_count; ++ii) {
+        int idx = (nu_home_arena + ii) % nu_arena_count;
+        if (pthread_mutex_trylock(&(nu_arenas[idx].lock)) == 0) {
+            nu_home_arena = idx;
+            return idx;
+        }
+    }
+
+    pthread_mutex_lock(&(nu_arenas[nu_home_arena].lock));
+    return nu_home_arena;
+}
+
 static
 nu_free_cell*
 make_cell()
 {
     void* addr = mmap(0, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    nu_free_cell* cell = (nu_free_cell*) addr; 
-    cell->size = CHUNK_SIZE;
+    nu_free_cell* cell = (nu_free_cell*) (addr + ALIGN_SKIP);
+    cell->size = CHUNK_CELL | FRESH_BIT;
     return cell;
 }
 
+static
 void*
-hmalloc(size_t usize)
+hmalloc_block(size_t usize, int hint, int* fresh)
 {
-    pthread_mutex_lock(&freelist_lock);
     int64_t size = (int64_t) usize;
 
     // space for size
@@ -128,47 +234,208 @@ hmalloc(size_t usize)
         alloc_size = CELL_SIZE;
     }
 
-    // TODO: Handle large allocations.
-    if (alloc_size > CHUNK_SIZE) {
+    // keep every cell a multiple of 16, so the next one stays aligned too
+    alloc_size = (alloc_size + 15) & ~((int64_t) 15);
+
+    // Large allocations belong to no arena and need no lock.
+    if (alloc_size > CHUNK_CELL) {
+        // the mapping is whole pages anyway; record that so the slack is usable
+        alloc_size = (alloc_size + ALIGN_SKIP + 4095) & ~((int64_t) 4095);
         void* addr = mmap(0, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        *((int64_t*)addr) = alloc_size;
-        pthread_mutex_unlock(&freelist_lock);
-        return addr + sizeof(int64_t);
+        *((int64_t*)(addr + ALIGN_SKIP)) = alloc_size;
+        __atomic_add_fetch(&nu_large_count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&nu_large_bytes, alloc_size, __ATOMIC_RELAXED);
+        *fresh = 1;
+        return addr + ALIGN_SKIP + sizeof(int64_t);
     }
 
-    nu_free_cell* cell = free_list_get_cell(alloc_size);
+    int idx = nu_arena_acquire(hint);
+    nu_arena* arena = &(nu_arenas[idx]);
+
+    nu_free_cell* cell = free_list_get_cell(arena, alloc_size);
     if (!cell) {
         cell = make_cell();
+        arena->chunks_mapped++;
     }
 
+    int64_t cell_fresh = cell->size & FRESH_BIT;
+    int64_t cell_size  = cell->size & ~FRESH_BIT;
+
     // Return unused portion to free list.
-    int64_t rest_size = cell->size - alloc_size;
+    int64_t rest_size = cell_size - alloc_size;
     if (rest_size >= CELL_SIZE) {
         void* addr = (void*) cell;
         nu_free_cell* rest = (nu_free_cell*) (addr + alloc_size);
-        rest->size = rest_size;
-        nu_free_list_insert(rest);
+        rest->size = rest_size | cell_fresh;
+        nu_free_list_insert(arena, rest);
+    }
+    else if (cell_size <= CHUNK_CELL) {
+        // the leftover is too small to track; hand it to the caller instead
+        alloc_size = cell_size;
     }
 
-    *((int64_t*)cell) = alloc_size;
-    pthread_mutex_unlock(&freelist_lock);
+    *((int64_t*)cell) = alloc_size | ((int64_t) idx << ARENA_SHIFT);
+    pthread_mutex_unlock(&(arena->lock));
+    *fresh = cell_fresh != 0;
     return ((void*)cell) + sizeof(int64_t);
 }
 
+void*
+hmalloc(size_t usize)
+{
+    int fresh;
+    return hmalloc_block(usize, XMALLOC_HINT_DEFAULT, &fresh);
+}
+
+void*
+hmalloc_hint(size_t usize, int hint)
+{
+    int fresh;
+    return hmalloc_block(usize, hint, &fresh);
+}
+
+void*
+hcalloc(size_t nmemb, size_t usize)
+{
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, usize, &bytes)) {
+        return 0;
+    }
+
+    int fresh;
+    void* addr = hmalloc_block(bytes, XMALLOC_HINT_DEFAULT, &fresh);
+
+    if (fresh) {
+        // only the free cell's next pointer was ever written past the size
+        *((int64_t*)addr) = 0;
+    }
+    else {
+        memset(addr, 0, husable_size(addr));
+    }
+    return addr;
+}
+
+size_t
+husable_size(void* addr)
+{
+    int64_t size = *((int64_t*) (addr - sizeof(int64_t))) & SIZE_MASK;
+    if (size > CHUNK_CELL) {
+        return (size_t) (size - ALIGN_SKIP - sizeof(int64_t));
+    }
+    return (size_t) (size - sizeof(int64_t));
+}
+
 void
 hfree(void* addr) 
 {
-    pthread_mutex_lock(&freelist_lock);
     nu_free_cell* cell = (nu_free_cell*)(addr - sizeof(int64_t));
-    int64_t size = *((int64_t*) cell);
+    int64_t header = *((int64_t*) cell);
+    int64_t size = header & SIZE_MASK;
 
-    if (size > CHUNK_SIZE) {
-        munmap((void*) cell, size);
+    if (size > CHUNK_CELL) {
+        __atomic_sub_fetch(&nu_large_count, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&nu_large_bytes, size, __ATOMIC_RELAXED);
+        munmap((void*) cell - ALIGN_SKIP, size);
     }
     else {
+        // blocks go back to the arena they were carved from
+        nu_arena* arena = &(nu_arenas[header >> ARENA_SHIFT]);
+        pthread_mutex_lock(&(arena->lock));
         cell->size = size;
-        nu_free_list_insert(cell);
+        nu_free_list_insert(arena, cell);
+        pthread_mutex_unlock(&(arena->lock));
+    }
+}
+
+// Copy an arena's records into *recs while holding its lock, so the caller can
+// write them out after unlocking. The buffer is mmapped, since this runs inside
+// the allocator, and grown between lock holds when the arena has outgrown it.
+// Returns the number of records, or -1 if the buffer cannot be grown.
+static
+long
+nu_arena_records(int ii, hmsnap_record** recs, long* cap)
+{
+    nu_arena* arena = &(nu_arenas[ii]);
+    for (;;) {
+        pthread_mutex_lock(&(arena->lock));
+        long nn = arena->chunks_mapped ? 1 : 0;
+        for (nu_free_cell* pp = arena->free_list; pp != 0; pp = pp->next) {
+            nn++;
+        }
+
+        if (nn <= *cap) {
+            hmsnap_record* rec = *recs;
+            memset(rec, 0, nn * sizeof(hmsnap_record));
+            if (arena->chunks_mapped) {
+                rec->kind  = HMSNAP_ARENA;
+                rec->owner = ii;
+                rec->bytes = arena->chunks_mapped * CHUNK_SIZE;
+                rec++;
+            }
+            for (nu_free_cell* pp = arena->free_list; pp != 0; pp = pp->next) {
+                rec->kind  = HMSNAP_FREE_CELL;
+                rec->owner = ii;
+                rec->flags = (pp->size & FRESH_BIT) ? HMSNAP_FRESH : 0;
+                rec->addr  = (uint64_t) pp;
+                rec->bytes = pp->size & ~FRESH_BIT;
+                rec++;
+            }
+            pthread_mutex_unlock(&(arena->lock));
+            return nn;
+        }
+        pthread_mutex_unlock(&(arena->lock));
+
+        // the list may change while unlocked, so count it again once there is room
+        if (*recs) {
+            munmap(*recs, *cap * sizeof(hmsnap_record));
+        }
+        *cap = 2 * nn;
+        *recs = mmap(0, *cap * sizeof(hmsnap_record), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (*recs == MAP_FAILED) {
+            *recs = 0;
+            *cap = 0;
+            return -1;
+        }
     }
-    pthread_mutex_unlock(&freelist_lock);
 }
 
+int
+hsnapshot(const char* path)
+{
+    pthread_once(&nu_arena_once, nu_arenas_init);
+
+    hmsnap_writer writer;
+    if (hmsnap_open(&writer, path, "hw7", 4096) == -1) {
+        return -1;
+    }
+
+    // one arena locked at a time, and only while its list is copied out;
+    // the file is written with no lock held
+    hmsnap_record* recs = 0;
+    long cap = 0;
+    for (int ii = 0; ii < NU_ALL_ARENAS; ++ii) {
+        long nn = nu_arena_records(ii, &recs, &cap);
+        if (nn == -1) {
+            hmsnap_close(&writer);
+            return -1;
+        }
+        for (long jj = 0; jj < nn; ++jj) {
+            hmsnap_put(&writer, &(recs[jj]), 0);
+        }
+    }
+    if (recs) {
+        munmap(recs, cap * sizeof(hmsnap_record));
+    }
+
+    hmsnap_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind  = HMSNAP_LARGE;
+    rec.used  = __atomic_load_n(&nu_large_count, __ATOMIC_RELAXED);
+    rec.bytes = __atomic_load_n(&nu_large_bytes, __ATOMIC_RELAXED);
+    if (rec.used) {
+        hmsnap_put(&writer, &rec, 0);
+    }
+
+    return hmsnap_close(&writer);
+}
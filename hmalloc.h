@@ -16,6 +16,12 @@ hm_stats* hgetstats();
 void hprintstats();
 
 void* hmalloc(size_t size);
+void* hcalloc(size_t nmemb, size_t size);
+// hint is one of the XMALLOC_HINT_* values from xmalloc.h
+void* hmalloc_hint(size_t size, int hint);
 void hfree(void* item);
+size_t husable_size(void* item);
+// Write the arenas' free lists and totals to path; see hmsnap.h
+int hsnapshot(const char* path);
 
 #endif
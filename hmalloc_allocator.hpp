@@ -0,0 +1,95 @@
+#ifndef HMALLOC_ALLOCATOR_HPP
+#define HMALLOC_ALLOCATOR_HPP
+
+// A standard allocator over xmalloc, for STL containers:
+//
+//     std::vector<long, hmalloc::allocator<long>> xs;
+//
+// Which allocator backs it is picked at link time, as for the C drivers
+// (sys_malloc.o, hw07_malloc.o or par_malloc.o). Every instance draws on the
+// same process-wide heap, so all of them compare equal and containers may
+// swap or move storage between instances freely.
+//
+// Link xnew.o as well to send plain new/delete, and so std::allocator, the
+// same way.
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#include "xmalloc.h"
+
+namespace hmalloc {
+
+// xmalloc only promises 16-byte alignment; types that need more go through
+// the aligned operator new, which xnew.cpp also routes to xmalloc when linked.
+template <class T>
+class allocator {
+public:
+    typedef T              value_type;
+    typedef T*             pointer;
+    typedef const T*       const_pointer;
+    typedef std::size_t    size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::true_type is_always_equal;
+
+    template <class U>
+    struct rebind {
+        typedef allocator<U> other;
+    };
+
+    allocator() noexcept {}
+
+    template <class U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T*
+    allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        if (alignof(T) > XMALLOC_ALIGNMENT) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        }
+        void* ptr = xmalloc(n * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void
+    deallocate(T* ptr, std::size_t n) noexcept
+    {
+        if (alignof(T) > XMALLOC_ALIGNMENT) {
+            ::operator delete(ptr, n * sizeof(T), std::align_val_t(alignof(T)));
+            return;
+        }
+        // the container always knows the size, so skip the allocator's lookup
+        xfree_sized(ptr, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool
+operator==(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool
+operator!=(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return false;
+}
+
+}
+
+#endif
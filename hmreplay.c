@@ -0,0 +1,309 @@
+
+// Replays an allocation trace recorded with HMALLOC_TRACE against whichever
+// xmalloc it is linked with (replay-sys, replay-hw7, replay-par).
+//
+// One thread is started per traced thread. In strict mode (the default)
+// every operation waits for the one before it in the trace, reproducing the
+// original interleaving exactly. In deps mode threads run freely and only
+// wait for the allocation of an object before freeing or resizing it.
+//
+// The tool keeps its own bookkeeping in mmap'd memory so that only the
+// traced operations go through xmalloc.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "xmalloc.h"
+#include "xtrace.h"
+
+typedef struct replay_thread {
+    pthread_t  thread;
+    uint64_t*  ops;     // indices into records, in trace order
+    uint64_t*  ranks;   // position of each op among all valid records
+    uint64_t   count;
+} replay_thread;
+
+static xtrace_record* records;
+static uint64_t       record_count;
+static void**         objects;
+static uint32_t*      object_sizes;
+static uint8_t*       object_ready;
+static int            strict = 1;
+
+static uint64_t       turn = 0;
+static long           live_bytes = 0;
+static long           peak_live_bytes = 0;
+static long           peak_rss_kb = 0;
+
+// resident memory is sampled every this many allocations, per thread
+#define RSS_SAMPLE_PERIOD 1024
+static __thread int   rss_countdown = 0;
+
+static
+void*
+map_zeroed(size_t bytes)
+{
+    void* addr = mmap(0, bytes ? bytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return addr;
+}
+
+static
+double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static
+long
+max_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static
+long
+current_rss_kb()
+{
+    // read by hand: stdio would allocate through the allocator under test
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = 0;
+
+    long pages = 0;
+    char* pp = strchr(buf, ' ');
+    if (pp) {
+        pages = atol(pp + 1);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static
+void
+sample_rss()
+{
+    long now = current_rss_kb();
+    long peak = __atomic_load_n(&peak_rss_kb, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&peak_rss_kb, &peak, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static
+void
+wait_until(int cond_is_turn, uint64_t rank, uint32_t id)
+{
+    for (int spins = 0; ; ++spins) {
+        if (cond_is_turn ? __atomic_load_n(&turn, __ATOMIC_ACQUIRE) == rank
+                         : __atomic_load_n(&object_ready[id], __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        if (spins > 64) {
+            sched_yield();
+        }
+    }
+}
+
+static
+void
+account(long delta)
+{
+    long now = __atomic_add_fetch(&live_bytes, delta, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&peak_live_bytes, &peak, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static
+void
+touch(void* ptr, size_t bytes)
+{
+    // dirty each page the program would have written, so RSS is meaningful
+    for (size_t ii = 0; ii < bytes; ii += 4096) {
+        ((volatile char*)ptr)[ii] = 1;
+    }
+}
+
+static
+void
+born(uint32_t id, void* ptr, uint32_t size)
+{
+    touch(ptr, size);
+    objects[id] = ptr;
+    object_sizes[id] = size;
+    account(size);
+    if (--rss_countdown <= 0) {
+        rss_countdown = RSS_SAMPLE_PERIOD;
+        sample_rss();
+    }
+    __atomic_store_n(&object_ready[id], 1, __ATOMIC_RELEASE);
+}
+
+static
+void*
+died(uint32_t id)
+{
+    if (!strict) {
+        wait_until(0, 0, id);
+    }
+    account(-(long)object_sizes[id]);
+    return objects[id];
+}
+
+static
+void
+replay_one(xtrace_record* rec)
+{
+    switch (rec->op) {
+    case XTRACE_MALLOC:
+        born(rec->id, xmalloc(rec->size), rec->size);
+        break;
+    case XTRACE_CALLOC:
+        born(rec->id, xcalloc(1, rec->size), rec->size);
+        break;
+    case XTRACE_FREE:
+        // id 0 was allocated before tracing started
+        if (rec->id) {
+            xfree(died(rec->id));
+        }
+        break;
+    case XTRACE_REALLOC: {
+        void* prev = rec->old_id ? died(rec->old_id) : 0;
+        void* next = prev ? xrealloc(prev, rec->size) : xmalloc(rec->size);
+        born(rec->id, next, rec->size);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static
+void*
+replay_worker(void* arg)
+{
+    replay_thread* self = (replay_thread*)arg;
+
+    for (uint64_t ii = 0; ii < self->count; ++ii) {
+        if (strict) {
+            wait_until(1, self->ranks[ii], 0);
+        }
+        replay_one(&records[self->ops[ii]]);
+        if (strict) {
+            __atomic_store_n(&turn, self->ranks[ii] + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "strict") && strcmp(argv[2], "deps"))) {
+        printf("Usage:\n");
+        printf("\t%s TRACE [strict|deps]\n", argv[0]);
+        return 1;
+    }
+    strict = (argc < 3 || strcmp(argv[2], "strict") == 0);
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(xtrace_header)) {
+        fprintf(stderr, "%s: cannot read trace\n", argv[1]);
+        return 1;
+    }
+
+    xtrace_header* hdr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(hdr != MAP_FAILED);
+    if (memcmp(hdr->magic, XTRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        sizeof(xtrace_header) + hdr->count * sizeof(xtrace_record) > (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a complete trace\n", argv[1]);
+        return 1;
+    }
+
+    records      = (xtrace_record*)(hdr + 1);
+    record_count = hdr->count;
+    objects      = map_zeroed((hdr->objects + 1) * sizeof(void*));
+    object_sizes = map_zeroed((hdr->objects + 1) * sizeof(uint32_t));
+    object_ready = map_zeroed(hdr->objects + 1);
+
+    // split the trace per thread, ranking the valid records in trace order
+    uint64_t nthreads = hdr->threads;
+    replay_thread* threads = map_zeroed((nthreads + 1) * sizeof(replay_thread));
+    for (uint64_t ii = 0; ii < record_count; ++ii) {
+        if (records[ii].op && records[ii].thread <= nthreads) {
+            threads[records[ii].thread].count++;
+        }
+    }
+    for (uint64_t tt = 1; tt <= nthreads; ++tt) {
+        threads[tt].ops   = map_zeroed(threads[tt].count * sizeof(uint64_t));
+        threads[tt].ranks = map_zeroed(threads[tt].count * sizeof(uint64_t));
+        threads[tt].count = 0;
+    }
+    uint64_t valid = 0;
+    for (uint64_t ii = 0; ii < record_count; ++ii) {
+        if (records[ii].op && records[ii].thread <= nthreads) {
+            replay_thread* rt = &threads[records[ii].thread];
+            rt->ops[rt->count]   = ii;
+            rt->ranks[rt->count] = valid++;
+            rt->count++;
+        }
+    }
+
+    // fault in the bookkeeping up front so only the allocator grows RSS from here
+    memset(objects, 0, (hdr->objects + 1) * sizeof(void*));
+    memset(object_sizes, 0, (hdr->objects + 1) * sizeof(uint32_t));
+    memset(object_ready, 0, hdr->objects + 1);
+
+    long base_rss = current_rss_kb();
+    peak_rss_kb = base_rss;
+    double t0 = now_seconds();
+
+    for (uint64_t tt = 1; tt <= nthreads; ++tt) {
+        int rv = pthread_create(&threads[tt].thread, 0, replay_worker, &threads[tt]);
+        assert(rv == 0);
+    }
+    for (uint64_t tt = 1; tt <= nthreads; ++tt) {
+        int rv = pthread_join(threads[tt].thread, 0);
+        assert(rv == 0);
+    }
+
+    double t1 = now_seconds();
+    sample_rss();
+    long peak_live_kb = (peak_live_bytes + 1023) / 1024;
+
+    // fragmentation: resident memory the allocator grew per KiB live at the trace's peak
+    printf("replay mode=%s ops=%lu threads=%lu time=%.6f peak_live_kb=%ld base_rss_kb=%ld peak_rss_kb=%ld max_rss_kb=%ld frag=%.3f\n",
+           strict ? "strict" : "deps", valid, nthreads, t1 - t0, peak_live_kb, base_rss, peak_rss_kb, max_rss_kb(),
+           peak_live_kb ? (double)(peak_rss_kb - base_rss) / peak_live_kb : 0.0);
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hmsnap.h"
+
+static
+void
+snap_write(hmsnap_writer* ww, const void* data, size_t len)
+{
+    const char* pp = data;
+    while (len > 0 && !ww->failed) {
+        if (ww->used == HMSNAP_BUFFER) {
+            if (write(ww->fd, ww->buf, ww->used) != (ssize_t)ww->used) {
+                ww->failed = 1;
+            }
+            ww->used = 0;
+        }
+        size_t nn = HMSNAP_BUFFER - ww->used;
+        if (nn > len) {
+            nn = len;
+        }
+        memcpy(ww->buf + ww->used, pp, nn);
+        ww->used += nn;
+        pp  += nn;
+        len -= nn;
+    }
+}
+
+int
+hmsnap_open(hmsnap_writer* ww, const char* path, const char* allocator, size_t page_size)
+{
+    ww->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ww->failed = (ww->fd == -1);
+    ww->count = 0;
+    ww->used = 0;
+    if (ww->failed) {
+        return -1;
+    }
+
+    // the count is filled in on close
+    hmsnap_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HMSNAP_MAGIC, sizeof(hdr.magic));
+    // the header is zeroed, so the name keeps its terminating NUL
+    strncpy(hdr.allocator, allocator, sizeof(hdr.allocator) - 1);
+    hdr.page_size = page_size;
+    snap_write(ww, &hdr, sizeof(hdr));
+    return 0;
+}
+
+void
+hmsnap_put(hmsnap_writer* ww, const hmsnap_record* rec, const uint64_t* bitmap)
+{
+    snap_write(ww, rec, sizeof(*rec));
+    if (rec->kind == HMSNAP_SLAB) {
+        snap_write(ww, bitmap, (rec->chunks + 63) / 64 * sizeof(uint64_t));
+    }
+    ww->count++;
+}
+
+int
+hmsnap_close(hmsnap_writer* ww)
+{
+    if (ww->fd == -1) {
+        return -1;
+    }
+    if (!ww->failed && ww->used > 0 && write(ww->fd, ww->buf, ww->used) != (ssize_t)ww->used) {
+        ww->failed = 1;
+    }
+    if (!ww->failed &&
+        pwrite(ww->fd, &ww->count, sizeof(ww->count), offsetof(hmsnap_header, count)) != sizeof(ww->count)) {
+        ww->failed = 1;
+    }
+    if (close(ww->fd) == -1) {
+        ww->failed = 1;
+    }
+    return ww->failed ? -1 : 0;
+}
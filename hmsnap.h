@@ -0,0 +1,67 @@
+#ifndef HMSNAP_H
+#define HMSNAP_H
+
+// Heap snapshots, written by xmalloc_snapshot and read by snapstat.
+//
+// A snapshot is a header followed by one record per slab, page run, large
+// mapping or free cell. Slab records are followed by their occupancy bitmap.
+// Addresses are kept so records can be lined up against /proc/PID/maps;
+// contents never are. The heap is walked a page (or an arena) at a time
+// while other threads keep running, so a snapshot is consistent per record
+// but not across records.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HMSNAP_MAGIC "HMSNAP01"
+
+enum {
+    HMSNAP_SLAB      = 1,  // par bucket slab: chunk_size, chunks, used, first; bitmap follows
+    HMSNAP_RUN       = 2,  // par page run in use
+    HMSNAP_FREE_RUN  = 3,  // par free page run
+    HMSNAP_LARGE     = 4,  // direct mapping; hw7 keeps no list, so one total with used = count
+    HMSNAP_ARENA     = 5,  // hw7 arena: bytes of chunks it has mapped
+    HMSNAP_FREE_CELL = 6,  // hw7 free-list cell
+};
+
+// flags
+#define HMSNAP_FRESH 1     // never handed out since mmap, so not resident
+
+typedef struct hmsnap_header {
+    char     magic[8];
+    char     allocator[8]; // "par" or "hw7", zero padded
+    uint64_t page_size;
+    uint64_t count;        // records
+} hmsnap_header;
+
+typedef struct hmsnap_record {
+    uint8_t  kind;
+    uint8_t  owner;        // par: the lifetime hint of the slab; hw7: the arena
+    uint8_t  flags;
+    uint8_t  pad;
+    uint32_t chunk_size;   // bytes per chunk
+    uint64_t addr;
+    uint64_t bytes;        // length of the memory described
+    uint32_t chunks;       // chunks in the slab; (chunks + 63) / 64 bitmap words follow
+    uint32_t used;         // chunks allocated
+    uint32_t first;        // offset of the first chunk from addr
+    uint32_t pad2;
+} hmsnap_record;
+
+// Buffered writer that never allocates, so it is safe inside the allocator
+#define HMSNAP_BUFFER 16384
+
+typedef struct hmsnap_writer {
+    int      fd;
+    int      failed;
+    uint64_t count;
+    size_t   used;
+    char     buf[HMSNAP_BUFFER];
+} hmsnap_writer;
+
+int  hmsnap_open(hmsnap_writer* ww, const char* path, const char* allocator, size_t page_size);
+void hmsnap_put(hmsnap_writer* ww, const hmsnap_record* rec, const uint64_t* bitmap);
+// Returns 0 once the whole snapshot is on disk, -1 if anything failed
+int  hmsnap_close(hmsnap_writer* ww);
+
+#endif
@@ -2,28 +2,119 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include "xmalloc.h"
+#include "xtrace.h"
 #include "hmalloc.h"
 
 void*
 xmalloc(size_t bytes)
 {
-    return hmalloc(bytes);
+    void* ptr = hmalloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+void*
+xcalloc(size_t nmemb, size_t bytes)
+{
+    void* ptr = hcalloc(nmemb, bytes);
+    XTRACE(xtrace_alloc(XTRACE_CALLOC, ptr, nmemb * bytes));
+    return ptr;
+}
+
+void*
+xmalloc_hint(size_t bytes, int flags)
+{
+    void* ptr = hmalloc_hint(bytes, flags);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
 }
 
 void
 xfree(void* ptr)
 {
+    XTRACE(xtrace_free(ptr));
+    hfree(ptr);
+}
+
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    // the block's own header already holds its size
+    XTRACE(xtrace_free(ptr));
     hfree(ptr);
 }
 
 void*
 xrealloc(void* prev, size_t bytes)
 {
-    void* new = xmalloc(bytes);
-    memcpy(new, prev, bytes);
-    xfree(prev);
+    uint32_t old_id = 0;
+    XTRACE(old_id = xtrace_realloc_begin(prev));
+
+    // the block may already be big enough for the new size
+    size_t usable = husable_size(prev);
+    void* new = prev;
+    if (bytes > usable) {
+        new = hmalloc(bytes);
+        memcpy(new, prev, usable);
+        hfree(prev);
+    }
+
+    XTRACE(xtrace_realloc_end(old_id, new, bytes));
     return new;
 }
 
+size_t
+xmalloc_usable_size(void* ptr)
+{
+    return husable_size(ptr);
+}
+
+void*
+xmalloc_at_least(size_t bytes, size_t* actual)
+{
+    void* ptr = hmalloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    if (actual) {
+        *actual = husable_size(ptr);
+    }
+    return ptr;
+}
+
+void*
+xmalloc_class(int cls, size_t bytes, int hint)
+{
+    // size classes are par's; the size is all hmalloc needs
+    void* ptr = hmalloc_hint(bytes, hint);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+void
+xfree_class(void* ptr)
+{
+    XTRACE(xtrace_free(ptr));
+    hfree(ptr);
+}
+
+int
+xmalloc_snapshot(const char* path)
+{
+    return hsnapshot(path);
+}
+
+int
+xmalloc_set_root(int slot, void* ptr)
+{
+    // the arenas are anonymous memory, gone with the process
+    errno = ENOSYS;
+    return -1;
+}
+
+void*
+xmalloc_get_root(int slot)
+{
+    return 0;
+}
@@ -2,33 +2,51 @@
 #define IVEC_H
 
 #include <assert.h>
+#include <string.h>
 
-#include "xmalloc.h"
+#include "xmalloc_fast.h"
 
+// The items live inline, in the same block as the header, until they outgrow
+// it; only then does data point at a separate array.
 typedef struct ivec {
     long  cap;
     long  size;
     long* data;
+    // the lifetime hint the ivec was made with, for its spilled array too
+    long  hint;
+    long  items[];
 } ivec;
 
+// hint is one of the XMALLOC_HINT_* lifetime hints
 static
 ivec*
-make_ivec(int cap0)
+make_ivec_hint(int cap0, int hint)
 {
     assert(cap0 > 0);
 
-    ivec* xs = xmalloc(sizeof(ivec));
-    xs->cap  = cap0;
+    ivec* xs = xmalloc_hint(sizeof(ivec) + cap0 * sizeof(long), hint);
     xs->size = 0;
-    xs->data = xmalloc(xs->cap * sizeof(long));
+    xs->data = xs->items;
+    xs->hint = hint;
+    // use whatever slack the allocator gave us
+    xs->cap  = (xmalloc_usable_size(xs) - sizeof(ivec)) / sizeof(long);
     return xs;
 }
 
+static
+ivec*
+make_ivec(int cap0)
+{
+    return make_ivec_hint(cap0, XMALLOC_HINT_DEFAULT);
+}
+
 static
 void
 free_ivec(ivec* xs)
 {
-    xfree(xs->data);
+    if (xs->data != xs->items) {
+        xfree(xs->data);
+    }
     xfree(xs);
 }
 
@@ -37,8 +55,16 @@ void
 ivec_push(ivec* xs, long item)
 {
     if (xs->size >= xs->cap) {
-        xs->cap *= 2;
-        xs->data = xrealloc(xs->data, xs->cap * sizeof(long));
+        if (xs->data == xs->items) {
+            // outgrew the inline items: move them to an array of their own
+            long* data = xmalloc_hint(2 * xs->cap * sizeof(long), xs->hint);
+            memcpy(data, xs->items, xs->size * sizeof(long));
+            xs->data = data;
+        }
+        else {
+            xs->data = xrealloc(xs->data, 2 * xs->cap * sizeof(long));
+        }
+        xs->cap  = xmalloc_usable_size(xs->data) / sizeof(long);
     }
 
     xs->data[xs->size] = item;
@@ -52,15 +78,33 @@ ivec_last(ivec* xs)
     return xs->data[xs->size - 1];
 }
 
+// Copy xs into one block with room for at least cap items;
+// hint is one of the XMALLOC_HINT_* lifetime hints
 static
 ivec*
-ivec_copy(ivec* xs)
+ivec_copy_cap_hint(ivec* xs, long cap, int hint)
 {
-    ivec* ys = make_ivec(xs->cap);
-    for (long ii = 0; ii < xs->size; ++ii) {
-        ivec_push(ys, xs->data[ii]);
+    if (cap < xs->size) {
+        cap = xs->size;
     }
+    ivec* ys = make_ivec_hint(cap > 0 ? cap : 1, hint);
+    memcpy(ys->data, xs->data, xs->size * sizeof(long));
+    ys->size = xs->size;
     return ys;
 }
 
+static
+ivec*
+ivec_copy_cap(ivec* xs, long cap)
+{
+    return ivec_copy_cap_hint(xs, cap, XMALLOC_HINT_DEFAULT);
+}
+
+static
+ivec*
+ivec_copy(ivec* xs)
+{
+    return ivec_copy_cap(xs, xs->size);
+}
+
 #endif
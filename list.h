@@ -1,7 +1,7 @@
 #ifndef LIST_H
 #define LIST_H
 
-#include "xmalloc.h"
+#include "xmalloc_fast.h"
 
 // Linked list cell.
 typedef struct cell {
@@ -9,16 +9,24 @@ typedef struct cell {
     struct cell* rest;
 } cell;
 
+// hint is one of the XMALLOC_HINT_* lifetime hints
 static
 cell*
-cons(long item, cell* rest)
+cons_hint(long item, cell* rest, int hint)
 {
-    cell* xs = xmalloc(sizeof(cell));
+    cell* xs = xmalloc_fast(sizeof(cell), hint);
     xs->item = item;
     xs->rest = rest;
     return xs;
 }
 
+static
+cell*
+cons(long item, cell* rest)
+{
+    return cons_hint(item, rest, XMALLOC_HINT_DEFAULT);
+}
+
 static
 long
 count_list(cell* xs)
@@ -37,21 +45,33 @@ free_list(cell* xs)
 {
     while (xs) {
         cell* ys = xs->rest;
-        xfree(xs);
+        xfree_fast(xs, sizeof(cell));
         xs = ys;
     }
 }
 
+// hint is one of the XMALLOC_HINT_* lifetime hints, for every cell of the copy
 static
 cell*
-copy_list(cell* xs)
+copy_list_hint(cell* xs, int hint)
 {
-    if (xs == 0) {
-        return 0;
+    // front to back, so long lists cannot overflow the stack
+    cell*  ys   = 0;
+    cell** tail = &ys;
+    while (xs) {
+        cell* zs = cons_hint(xs->item, 0, hint);
+        *tail = zs;
+        tail  = &zs->rest;
+        xs    = xs->rest;
     }
+    return ys;
+}
 
-    cell* ys = copy_list(xs->rest);
-    return cons(xs->item, ys);
+static
+cell*
+copy_list(cell* xs)
+{
+    return copy_list_hint(xs, XMALLOC_HINT_DEFAULT);
 }
 
 #endif
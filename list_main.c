@@ -20,22 +20,42 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sched.h>
 
 #include "xmalloc.h"
+#include "wsdeque.h"
+#include "saved_run.h"
 #include "list.h"
 
 #define THREADS 4
+#define REPEATS 1
 
 typedef struct num_task {
     cell* vals;
     long  steps;
-    int   dibs;
-    pthread_mutex_t lock;
 } num_task;
 
+// The persistent heap root this driver keeps its finished tasks in (see saved_run.h)
+#define SAVED_ROOT 0
+
 num_task** tasks;
 long data_top = 0;
 
+// One deque of task indices per worker; a task is in at most one deque, and in
+// none while a worker runs it or once it is done
+ws_deque* deques;
+int  num_workers = 0;
+long tasks_left = 0;
+
+double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 long
 collatz_step(long n)
 {
@@ -53,116 +73,190 @@ iterate(cell* xs)
     long vv = 0;
     for (int jj = 0; vv != 1 && jj < 50; ++jj) {
         vv = collatz_step(xs->item);
-        xs = cons(vv, xs);
+        xs = cons_hint(vv, xs, XMALLOC_HINT_SHORT_LIVED);
     }
     return xs;
 }
 
+// Run one pass of task ii, returning 1 if it needs another
 int
-scan_and_iterate()
+run_task(long ii)
+{
+    cell* xs = tasks[ii]->vals;
+    long vv = xs->item;
+
+    if (vv > 1) {
+        // the next pass replaces this copy
+        xs = copy_list_hint(xs, XMALLOC_HINT_SHORT_LIVED);
+        xs = iterate(xs);
+        free_list(tasks[ii]->vals);
+        tasks[ii]->vals = xs;
+        return 1;
+    }
+
+    // the last copy stays until teardown: move it off the short-lived pages it would pin
+    xs = copy_list_hint(xs, XMALLOC_HINT_LONG_LIVED);
+    free_list(tasks[ii]->vals);
+    tasks[ii]->vals = xs;
+    tasks[ii]->steps = count_list(xs) - 1;
+    return 0;
+}
+
+void*
+worker(void* arg)
 {
-    long done_count = 0;
-    long base = random() % data_top;
+    long self = (long)arg;
+    unsigned int seed = self + 1;
 
-    for (long i0 = 1; i0 < data_top; ++i0) {
-        long ii = 1 + (base + i0) % (data_top - 1);
+    while (__atomic_load_n(&tasks_left, __ATOMIC_ACQUIRE) > 0) {
+        long ii = ws_pop(&deques[self]);
 
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        int skip = tasks[ii]->dibs;
-        if (!skip) {
-            tasks[ii]->dibs = 1;
+        // out of work: steal the oldest task of another worker, trying each from a random one
+        int victim = rand_r(&seed) % num_workers;
+        for (int kk = 0; ii == WS_EMPTY && kk < num_workers; ++kk) {
+            ii = ws_steal(&deques[(victim + kk) % num_workers]);
         }
-        pthread_mutex_unlock(&(tasks[ii]->lock));
-        if (skip) {
+        if (ii == WS_EMPTY) {
+            // the last tasks are running elsewhere
+            sched_yield();
             continue;
         }
 
-        cell* xs = tasks[ii]->vals;
-        long vv = xs->item;
-
-        if (vv > 1) {
-            xs = copy_list(xs);
-            xs = iterate(xs);
-            free_list(tasks[ii]->vals);
-            tasks[ii]->vals = xs;
+        if (run_task(ii)) {
+            ws_push(&deques[self], ii);
         }
         else {
-            if (tasks[ii]->steps == -1) {
-                tasks[ii]->steps = count_list(tasks[ii]->vals) - 1;
-            }
-
-            done_count += 1;
+            __atomic_fetch_sub(&tasks_left, 1, __ATOMIC_RELEASE);
         }
-
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        tasks[ii]->dibs = 0;
-        pthread_mutex_unlock(&(tasks[ii]->lock));
     }
+    return 0;
+}
+
+void
+find_max(long* max_v, long* max_s)
+{
+    *max_v = 0;
+    *max_s = 0;
 
-    return done_count == (data_top - 1);
+    for (int ii = 0; ii < data_top; ++ii) {
+        if (tasks[ii]->steps > *max_s) {
+            *max_v = ii;
+            *max_s = tasks[ii]->steps;
+        }
+    }
 }
 
-void*
-worker(void* _arg)
+// Free a table of top tasks: this run's, or one kept from an earlier run
+void
+free_tasks(void* table, long top)
 {
-    int done = 0;
-    while (!done) {
-        done = scan_and_iterate();
+    num_task** tt = table;
+    for (int ii = 0; ii < top; ++ii) {
+        free_list(tt[ii]->vals);
+        xfree_fast(tt[ii], sizeof(num_task));
     }
-    return 0;
+    xfree(tt);
 }
 
 int
 main(int argc, char* argv[])
 {
-    pthread_t threads[THREADS];
     int rv;
 
-    if (argc != 2) {
+    if (argc < 2 || argc > 4) {
         printf("Usage:\n");
-        printf("\t%s TOP\n", argv[0]);
+        printf("\t%s TOP [THREADS [REPEATS]]\n", argv[0]);
         return 1;
     }
 
-    data_top  = atol(argv[1]);
+    data_top = atol(argv[1]);
+    int nthreads = (argc > 2) ? atoi(argv[2]) : THREADS;
+    int repeats  = (argc > 3) ? atoi(argv[3]) : REPEATS;
 
-    tasks = xmalloc(data_top * sizeof(num_task*));
-    for (int ii = 0; ii < data_top; ++ii) {
-        tasks[ii] = xmalloc(sizeof(num_task));
-        tasks[ii]->vals  = cons(ii, 0);
-        tasks[ii]->steps = -1;
-        tasks[ii]->dibs  = 0;
-        pthread_mutex_init(&(tasks[ii]->lock), 0);
+    if (data_top < 2 || nthreads < 1 || repeats < 1) {
+        printf("TOP must be at least 2; THREADS and REPEATS at least 1\n");
+        return 1;
     }
 
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_create(&(threads[ii]), 0, worker, 0);
-        assert(rv == 0);
-    }
+    pthread_t threads[nthreads];
+    const char* snapshot_path = getenv("HMALLOC_SNAPSHOT");
+    long max_v = 0;
+    long max_s = 0;
 
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_join(threads[ii], 0);
-        assert(rv == 0);
+    // a persistent heap may hold the answer already; one for another TOP is dropped
+    tasks = saved_run_find(SAVED_ROOT, data_top, free_tasks);
+    if (tasks) {
+        double t0 = now_seconds();
+        find_max(&max_v, &max_s);
+        printf("result driver=%s top=%ld restored=%.6f\n", "list", data_top, now_seconds() - t0);
+        printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+        return 0;
     }
 
-    long max_v = 0;
-    long max_s = 0;
+    for (int rep = 0; rep < repeats; ++rep) {
+        double t0 = now_seconds();
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        if (tasks[ii]->steps > max_s) {
-            max_v = ii;
-            max_s = tasks[ii]->steps;
+        // the task table outlives every sequence it points to
+        tasks = xmalloc_hint(data_top * sizeof(num_task*), XMALLOC_HINT_LONG_LIVED);
+        for (int ii = 0; ii < data_top; ++ii) {
+            tasks[ii] = xmalloc_fast(sizeof(num_task), XMALLOC_HINT_LONG_LIVED);
+            tasks[ii]->vals  = cons(ii, 0);
+            tasks[ii]->steps = -1;
         }
-    }
 
-    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+        // deal the tasks out round robin; task 0 is not a starting value
+        ws_deque worker_deques[nthreads];
+        deques = worker_deques;
+        num_workers = nthreads;
+        for (int ii = 0; ii < nthreads; ++ii) {
+            ws_init(&deques[ii], data_top);
+        }
+        for (long ii = 1; ii < data_top; ++ii) {
+            ws_push(&deques[ii % nthreads], ii);
+        }
+        tasks_left = data_top - 1;
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        free_list(tasks[ii]->vals);
-        xfree(tasks[ii]);
+        double t1 = now_seconds();
+
+        for (int ii = 0; ii < nthreads; ++ii) {
+            rv = pthread_create(&(threads[ii]), 0, worker, (void*)(long)ii);
+            assert(rv == 0);
+        }
+
+        for (int ii = 0; ii < nthreads; ++ii) {
+            rv = pthread_join(threads[ii], 0);
+            assert(rv == 0);
+        }
+
+        for (int ii = 0; ii < nthreads; ++ii) {
+            ws_destroy(&deques[ii]);
+        }
+
+        double t2 = now_seconds();
+
+        // snapshot the heap at its fullest, keeping the time it takes out of teardown
+        if (snapshot_path && rep == repeats - 1) {
+            if (xmalloc_snapshot(snapshot_path) == -1) {
+                perror("HMALLOC_SNAPSHOT");
+            }
+            t2 = now_seconds();
+        }
+
+        find_max(&max_v, &max_s);
+
+        // a persistent heap keeps the last table for the next run instead
+        if (rep < repeats - 1 || !saved_run_keep(SAVED_ROOT, data_top, tasks)) {
+            free_tasks(tasks, data_top);
+        }
+
+        double t3 = now_seconds();
+
+        // one line per repeat, for bench.sh and friends
+        printf("result driver=%s top=%ld threads=%d rep=%d setup=%.6f iterate=%.6f teardown=%.6f\n",
+               "list", data_top, nthreads, rep, t1 - t0, t2 - t1, t3 - t2);
     }
-    xfree(tasks);
+
+    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
 
     return 0;
 }
-
@@ -1,131 +1,235 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "xmalloc.h"
-
-// temporary
-#include <stdio.h>
+#include "xtrace.h"
+#include "hmsnap.h"
+#include "size_classes.h"
 
 // ============================== OTHER CONSTANTS =================================== //
 
-// The mmap allocation size threshold
-const int THRESHOLD_MMAP_SIZE = 4096;
-
-#define BUCKET_NUM_BUCKETS 10
-
-// The number of longs that comprise the bitflag field in each page header
-#define PAGE_HEADER_NUM_BITFLAG_LONGS 3
-
 // The number of bytes per page 
 #define PAGE_SIZE 4096
 
-// The number of bits in a long
-#define NUM_BITS_PER_LONG (8 * sizeof(long))
-
-// ======================== BUCKET THRESHOLD CONSTANTS ============================== //
-
-
-// The size of a linked list node allocation
-//                                 (16 = sizeof(cell))
-#define BUCKET_LINKED_LIST_CELL 16 + sizeof(long*)
-
-// The size of an empty ivec
-//                           (24 = sizeof(ivec))
-#define BUCKET_EMPTY_IVEC 24 + sizeof(long*)
-
-// The size of ivec->data when ivec->cap == 4
-//                            (32 = sizeof(long) * 4)
-#define BUCKET_IVEC_DATA_4 32 + sizeof(long*)
-
-// The size of tasks[ii] AND ivec->data when ivec->cap == 8
-//                         (64 = sizeof(num_task))
-//                         (64 = sizeof(long) * 8)
-#define BUCKET_NUM_TASK 64 + sizeof(long*)
+// The largest slab, in pages, a size class may use for its chunks
+#define SLAB_MAX_PAGES 16
 
-// The size of ivec->data when ivec->cap == 16
-//                             (128 = sizeof(long) * 16)
-#define BUCKET_IVEC_DATA_16 128 + sizeof(long*)
+// Each class takes the smallest slab that loses at most 1/SLAB_WASTE_DIVISOR of itself
+// to the header and the tail the chunks cannot fill
+#define SLAB_WASTE_DIVISOR 8
 
-// The size of ivec->data when ivec->cap == 32
-//                             (256 = sizeof(long) * 32)
-#define BUCKET_IVEC_DATA_32 256 + sizeof(long*)
+// The number of bits in a long
+#define NUM_BITS_PER_LONG (8 * sizeof(long))
 
-// The size of ivec->data when ivec->cap == 64
-//                             (512 = sizeof(long) * 64)
-#define BUCKET_IVEC_DATA_64 512 + sizeof(long*)
+// Requests past the last size class up to this many pages are carved from page runs;
+// anything larger is mapped directly
+#define RUN_MAX_PAGES 256
 
-// The size of tasks when data_top = 100 (this is the case for some tests)
-//       (sizeof(num_tasks*)) = 8;  800 = 8 * data_top
-#define BUCKET_TASKS_DATATOP100 800 + sizeof(long*) 
+// Page runs are cut from regions of this many pages, mapped as needed and never returned
+#define RUN_REGION_PAGES 1024
 
-// The size of ivec->data when ivec->cap == 128
-//                              (1024 = sizeof(long) * 128)
-#define BUCKET_IVEC_DATA_128 1024 + sizeof(long*)
+// With HMALLOC_RESERVE set, a background thread keeps up to this many pre-faulted
+// slabs on hand per size class, refilling every RESERVE_PERIOD_MS or when one runs low
+#define RESERVE_MAX_SLABS 64
+#define RESERVE_PERIOD_MS 10
 
-// The size of ivec->data when ivec->cap == 256
-//                              (2048 = sizeof(long) * 256)
-#define BUCKET_IVEC_DATA_256 2048 + sizeof(long*)
+// With HMALLOC_PERSIST naming a file, every page comes from that file mapped at this
+// fixed address, so pointers stored in the heap stay valid from one run to the next
+// It is 1 GiB aligned, so the page map leaves covering the heap can live in the file too
+#define PERSIST_BASE ((uintptr_t)0x500000000000)
+// The size of a new persistent heap; the file is sparse, so only pages in use take disk space
+#define PERSIST_HEAP_BYTES ((size_t)16 << 30)
+#define PERSIST_MAGIC "HMPERS02"
 
-// Anything above this is larger than THRESHOLD_MMAP_SIZE and will be directed to mmap directly
+// The cache line size: page layouts are shifted in steps of this
+#define CACHE_LINE_SIZE 64
 
+// Whether to rotate the header and chunks of successive pages of a bucket through
+// the page's leftover space, so hot headers and first chunks spread over the cache sets
+// (build with -DPAGE_CACHE_COLORING=0 to compare)
+#ifndef PAGE_CACHE_COLORING
+#define PAGE_CACHE_COLORING 1
+#endif
 
 // ================================== TYPEDEFS ========================================= //
 
-// A metadata header appended onto the beginning of every page allocated in the bucket system
-// Contains all necessary data for allocating and freeing chunks within this page
+// A metadata header appended onto the beginning of every slab allocated in the bucket system
+// Contains all necessary data for allocating and freeing chunks within this slab
+// A slab is one or more contiguous pages (see slabGeometry); "page" below means the whole slab
 typedef struct page_header_t {
     // the size of each chunk within this page                                      8 bytes
     size_t page_chunks_size;
-    // the pointer to the next page in the list                                     8 bytes
+    // the next page on the bucket's list of pages with free chunks                 8 bytes
     struct page_header_t* next_page;
     // the mutex for this page                                                      40 bytes (!)
     pthread_mutex_t page_mutex;                             
-    // the set of longs containing the bitflags for the free status of this page    16 bytes
+    // the index of the first chunk never handed out since the page was mapped     4 bytes
+    int page_fresh_index;
+    // the lifetime hint (XMALLOC_HINT_*) of the page set this page belongs to      4 bytes
+    int page_hint;
+    // the number of chunks in this page                                            4 bytes
+    int page_num_chunks;
+    // the number of 4 KiB pages this slab spans                                    4 bytes
+    int page_slab_pages;
+    // whether the page is on its bucket's list; set under the bucket mutex,        4 bytes
+    // cleared under both it and the page mutex
+    int page_listed;
+    // the bitflags for the free status of each chunk, one long per 64 chunks       8 bytes each
     // NOTE: a bit value of '0' signifies a FREE chunk; a bit value of '1' signifies an ALLOCATED chunk
-    long bitflags[PAGE_HEADER_NUM_BITFLAG_LONGS];                 
-} page_header_t;                                                //                  72 bytes (!!!)
-// percent data usable = 1 - (72 / 4096) = 98.2%
-
-// A metadata header appended onto the top of every piece of data allocated within a page in the bucket system
-// Contains the address of the start of the page 
-typedef struct data_chunk_header_t {
-    // the address of the start of this page (address to the page_header_t)         8 bytes
-    struct page_header_t* page_header_address;
-} data_chunk_header_t;                                          //                  8 bytes
+    long bitflags[];
+} page_header_t;                                                //                  80 bytes + bitflags
+// e.g. 16-byte chunks: 4 bitflag longs, 249 chunks, 1 - (112 / 4096) = 97.3% usable
 
 // The bucket system consists of an array of long pointers
+// Each lifetime hint has its own set of buckets, so its objects never share a page with another hint's
+// A bucket lists only its pages with free chunks, so allocation never walks past full ones;
+// the page map finds the others when their chunks are freed
 typedef struct bucket_allocator_t {
-    // the array of pointers to linked lists of pages for each size
-    page_header_t* buckets[BUCKET_NUM_BUCKETS]; 
+    // the array of pointers to linked lists of pages with free chunks for each hint and size
+    page_header_t* buckets[XMALLOC_NUM_HINTS][BUCKET_NUM_BUCKETS]; 
+    // the number of pages made so far for each size, which picks the next page's color
+    unsigned long pages_made[BUCKET_NUM_BUCKETS];
 } bucket_allocator_t;
 
-// A header for directly mapped pages
-typedef struct direct_map_page_t {
-    // the size of the page
-    size_t size;
-    // some thing to distinguish the directly mapped page from the allocated chunks
-    long key;
-} direct_map_page_t;
+// An entry in the page map, describing the 4 KiB page that contains an address
+//   0                           the page was not handed out by this allocator
+//   header | PAGE_MAP_SMALL     a page of a bucket slab; the rest of the entry is the slab's page_header_t*
+//   npages << 2 | PAGE_MAP_LARGE the first page of a direct mapping npages long
+//   npages << 3 | PAGE_MAP_RUN   the first page of an allocated page run npages long
+//   npages << 3 | PAGE_MAP_RUN_FREE | PAGE_MAP_RUN
+//                                the first and the last page of a free page run npages long
+// The other pages of a direct mapping or a page run map to 0
+typedef uintptr_t page_map_entry_t;
+
+#define PAGE_MAP_SMALL 1
+#define PAGE_MAP_LARGE 2
+#define PAGE_MAP_RUN 3
+#define PAGE_MAP_TAG_MASK 3
+#define PAGE_MAP_RUN_FREE 4
+
+// A free page run keeps its links in its own first page
+typedef struct run_node_t {
+    struct run_node_t* next;
+    struct run_node_t* prev;
+    long npages;
+} run_node_t;
+
+// The page run allocator: free runs of 1 to RUN_MAX_PAGES pages each have a bin,
+// and the last bin holds everything longer
+#define RUN_NUM_BINS (RUN_MAX_PAGES + 1)
+#define RUN_BIN_LONGS ((RUN_NUM_BINS + 63) / 64)
+
+typedef struct run_allocator_t {
+    // one lock for every run: medium blocks are rare next to bucket chunks
+    pthread_mutex_t run_mutex;
+    // bins[i] lists the free runs of i + 1 pages
+    run_node_t* bins[RUN_NUM_BINS];
+    // a set bit marks a non-empty bin, so best fit is a scan for the next set bit
+    unsigned long bin_bits[RUN_BIN_LONGS];
+    // the part of the newest region never handed out, still zero from mmap
+    void* wild_start;
+    void* wild_end;
+} run_allocator_t;
+
+// The slabs set aside for one size class by the reserve thread
+typedef struct slab_reserve_t {
+    pthread_mutex_t mutex;
+    void* slabs[RESERVE_MAX_SLABS];
+    int count;
+    // how many slabs to keep, from the rate the class has been using them
+    int target;
+    // slabs the class has made, and the count at the reserve thread's last look
+    unsigned long made;
+    unsigned long made_seen;
+} slab_reserve_t;
+
+// The page map is a two level radix tree over the 48-bit address space
+// 36 bits of page number split into 18 bits for the root and 18 bits for each leaf
+#define PAGE_MAP_ADDRESS_BITS 48
+#define PAGE_MAP_PAGE_SHIFT 12
+#define PAGE_MAP_LEAF_BITS 18
+#define PAGE_MAP_ROOT_BITS (PAGE_MAP_ADDRESS_BITS - PAGE_MAP_PAGE_SHIFT - PAGE_MAP_LEAF_BITS)
+#define PAGE_MAP_LEAF_ENTRIES ((size_t)1 << PAGE_MAP_LEAF_BITS)
+#define PAGE_MAP_ROOT_ENTRIES ((size_t)1 << PAGE_MAP_ROOT_BITS)
+// the bytes of address space one leaf covers (1 GiB) and the bytes of the leaf itself (2 MiB)
+#define PAGE_MAP_LEAF_SPAN ((size_t)1 << (PAGE_MAP_LEAF_BITS + PAGE_MAP_PAGE_SHIFT))
+#define PAGE_MAP_LEAF_BYTES (PAGE_MAP_LEAF_ENTRIES * sizeof(page_map_entry_t))
+
+// The start of a persistent heap file, at PERSIST_BASE
+// The page map leaves covering the whole file follow it, then the pages the heap hands out
+typedef struct persist_header_t {
+    char magic[8];
+    // the size of the file, a whole number of leaf spans
+    size_t heap_bytes;
+    // the size classes the heap was built with: it is only reopened with the same ones
+    int num_buckets;
+    size_t classes[BUCKET_NUM_BUCKETS];
+    // set by a clean exit, and cleared while a process has the heap open
+    int clean;
+    // the offset of the first byte never handed out
+    size_t top;
+    // where the program keeps the way back to its data (see xmalloc_set_root)
+    void* roots[XMALLOC_PERSIST_ROOTS];
+    // the allocator state at the last clean exit, so reopening needs no recovery pass
+    bucket_allocator_t buckets;
+    run_node_t* bins[RUN_NUM_BINS];
+    unsigned long bin_bits[RUN_BIN_LONGS];
+    void* wild_start;
+    void* wild_end;
+} persist_header_t;
+
+// The bytes at the start of the file taken by the header, rounded up to whole pages
+#define PERSIST_HEADER_BYTES ((sizeof(persist_header_t) + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1))
 
 // ============================== GLOBAL POINTERS =================================== //
 
 // The bucket allocator
 bucket_allocator_t bucket_allocator; 
 
-// a flag representing whether the allocator has been initialized
-char bucket_allocator_has_been_allocated = 0;
+// The locks on the bucket lists, taken before any page mutex
+pthread_mutex_t bucket_mutexes[XMALLOC_NUM_HINTS][BUCKET_NUM_BUCKETS] = {
+    [0 ... XMALLOC_NUM_HINTS - 1] = { [0 ... BUCKET_NUM_BUCKETS - 1] = PTHREAD_MUTEX_INITIALIZER }
+};
+
+// The page run allocator
+run_allocator_t run_allocator = { PTHREAD_MUTEX_INITIALIZER };
+
+// The slab reserves, one per size class, filled only while reserve_enabled
+slab_reserve_t slab_reserves[BUCKET_NUM_BUCKETS];
+int reserve_enabled = 0;
+pthread_t reserve_thread;
+pthread_mutex_t reserve_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reserve_wake = PTHREAD_COND_INITIALIZER;
+
+// The persistent heap, or null unless HMALLOC_PERSIST is set
+persist_header_t* persist_heap = 0;
+
+// The root of the page map: leaves are mapped on demand and never freed
+// 2 MiB of bss, of which only the touched pages are ever backed
+page_map_entry_t* page_map_root[PAGE_MAP_ROOT_ENTRIES];
+
+// The allocation size profile, recorded when HMALLOC_PROFILE names a file
+// one counter per 8 bytes of request size; the last counts everything larger
+#define PROFILE_GRANULE 8
+#define PROFILE_MAX_SIZE 8192
+#define PROFILE_NUM_BINS (PROFILE_MAX_SIZE / PROFILE_GRANULE + 1)
+int profile_enabled = 0;
+long profile_histogram[PROFILE_NUM_BINS];
 
 // An array of all possible allocation sizes
-size_t BUCKET_THRESHOLD_ARRAY[BUCKET_NUM_BUCKETS] = {   
-    BUCKET_LINKED_LIST_CELL,    BUCKET_EMPTY_IVEC,      BUCKET_IVEC_DATA_4,     BUCKET_NUM_TASK, 
-    BUCKET_IVEC_DATA_16,        BUCKET_IVEC_DATA_32,    BUCKET_IVEC_DATA_64,    BUCKET_TASKS_DATATOP100, 
-    BUCKET_IVEC_DATA_128,       BUCKET_IVEC_DATA_256 
-};
+// (see size_classes.h; make pgo regenerates it from a profile)
+size_t BUCKET_THRESHOLD_ARRAY[BUCKET_NUM_BUCKETS] = BUCKET_CLASS_SIZES;
 
 // ================================== FUNCTIONS ====================================== //
 
@@ -142,6 +246,108 @@ check_rv(long rv)
     }
 }
 
+// To report a pointer that this allocator never handed out, then stop before the heap is corrupted
+    void
+reportBadPointer(const char* where, void* ptr)
+{
+    fprintf(stderr, "%s: invalid pointer %p (not from xmalloc, or already freed)\n", where, ptr);
+    fflush(stderr);
+    abort();
+}
+
+// To look up the page map entry for the page containing the given address
+// Lock-free: one load for the leaf and one for the entry
+page_map_entry_t pageMapGet(void* addr)
+{
+    uintptr_t page = (uintptr_t)addr >> PAGE_MAP_PAGE_SHIFT;
+    if (page >> (PAGE_MAP_ROOT_BITS + PAGE_MAP_LEAF_BITS))
+    {
+        return 0;
+    }
+    page_map_entry_t* leaf = __atomic_load_n(&page_map_root[page >> PAGE_MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+    if (!leaf)
+    {
+        return 0;
+    }
+    return __atomic_load_n(&leaf[page & (PAGE_MAP_LEAF_ENTRIES - 1)], __ATOMIC_ACQUIRE);
+}
+
+// To set the page map entry for the page containing the given address, creating its leaf if needed
+void pageMapSet(void* addr, page_map_entry_t entry)
+{
+    uintptr_t page = (uintptr_t)addr >> PAGE_MAP_PAGE_SHIFT;
+    assert((page >> (PAGE_MAP_ROOT_BITS + PAGE_MAP_LEAF_BITS)) == 0);
+    page_map_entry_t** slot = &page_map_root[page >> PAGE_MAP_LEAF_BITS];
+    page_map_entry_t* leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (!leaf)
+    {
+        // map a leaf and race to install it; the loser unmaps its copy
+        page_map_entry_t* newLeaf = mmap(0, PAGE_MAP_LEAF_ENTRIES * sizeof(page_map_entry_t),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        check_rv((long)newLeaf);
+        if (__atomic_compare_exchange_n(slot, &leaf, newLeaf, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            leaf = newLeaf;
+        }
+        else
+        {
+            munmap(newLeaf, PAGE_MAP_LEAF_ENTRIES * sizeof(page_map_entry_t));
+        }
+    }
+    __atomic_store_n(&leaf[page & (PAGE_MAP_LEAF_ENTRIES - 1)], entry, __ATOMIC_RELEASE);
+}
+
+// To start recording the allocation size profile if HMALLOC_PROFILE is set
+__attribute__((constructor))
+    void
+profileStart()
+{
+    const char* path = getenv("HMALLOC_PROFILE");
+    profile_enabled = (path && *path);
+}
+
+// To count one allocation of the given request size in the profile
+    void
+profileRecord(size_t bytes)
+{
+    size_t bin = (bytes + PROFILE_GRANULE - 1) / PROFILE_GRANULE;
+    if (bin >= PROFILE_NUM_BINS)
+    {
+        bin = PROFILE_NUM_BINS - 1;
+    }
+    __atomic_fetch_add(&profile_histogram[bin], 1, __ATOMIC_RELAXED);
+}
+
+// To append the profile to the HMALLOC_PROFILE file as "bytes count" lines for gen_classes
+// Runs at exit; repeated runs accumulate in the same file
+__attribute__((destructor))
+    void
+profileWrite()
+{
+    if (!profile_enabled)
+    {
+        return;
+    }
+    FILE* out = fopen(getenv("HMALLOC_PROFILE"), "a");
+    if (!out)
+    {
+        perror("HMALLOC_PROFILE");
+        return;
+    }
+    for (int i = 0; i < PROFILE_NUM_BINS - 1; i++)
+    {
+        if (profile_histogram[i])
+        {
+            fprintf(out, "%d %ld\n", i * PROFILE_GRANULE, profile_histogram[i]);
+        }
+    }
+    if (profile_histogram[PROFILE_NUM_BINS - 1])
+    {
+        fprintf(out, "large %ld\n", profile_histogram[PROFILE_NUM_BINS - 1]);
+    }
+    fclose(out);
+}
+
 // To determine the index of the appropriate bucket for the given allocation
 int sizeToBucketIndex(size_t size)
 {
@@ -156,97 +362,263 @@ int sizeToBucketIndex(size_t size)
     assert(0); 
 }
 
-// To determine the index of the appropriate bucket for the given allocation
-int allocationToBucketIndex(long* data)
-{ 
-    // Get the size: 8 bytes behind the pointer
-    size_t size = *(data - sizeof(size_t));
-    // return the index
-    return sizeToBucketIndex(size);
-}
-
-// To determine if an allocation of the given size is large enough to be passed directly to mmap
+// To determine if an allocation of the given size is too large for the buckets (see allocChunk)
 int largerThanPage(size_t size)
 {
     return (size > BUCKET_THRESHOLD_ARRAY[BUCKET_NUM_BUCKETS - 1]);
 }
 
-// To initialize a new page with chunks of the given size
-page_header_t* makeNewPage(size_t size)
+// To determine the size of the header of a page holding the given number of chunks
+// Rounded up so the chunks after it start XMALLOC_ALIGNMENT aligned
+long headerBytesForChunks(long numChunks)
 {
-    // step 1: compute all required values for the page header  
-    page_header_t header;
-    // set the size for each chunk in this page as the size for this bucket
-    header.page_chunks_size = size;
-    // set the next page pointer to null
-    header.next_page = 0;
-    // set the bitflag longs to 0: nothing is allocated yet 
-    for (int i = 0; i < PAGE_HEADER_NUM_BITFLAG_LONGS; i++)
+    long numLongs = (numChunks + NUM_BITS_PER_LONG - 1) / NUM_BITS_PER_LONG;
+    long bytes = sizeof(page_header_t) + numLongs * sizeof(long);
+    return (bytes + XMALLOC_ALIGNMENT - 1) & ~(long)(XMALLOC_ALIGNMENT - 1);
+}
+
+// To determine how many chunks of the given size fit in a slab of the given bytes, header included
+long chunksInSlab(size_t size, long slabBytes)
+{
+    long numChunks = (slabBytes - sizeof(page_header_t)) / size;
+    // each 64 chunks cost another bitflag long, which may push the last chunk out
+    while (numChunks > 0 && headerBytesForChunks(numChunks) + numChunks * (long)size > slabBytes)
     {
-        header.bitflags[i] = 0;
+        numChunks--;
     }
-    // initialize the mutex 
-    pthread_mutex_t mutex;
-    int rv = pthread_mutex_init(&mutex, 0);
-    check_rv(rv);
-    header.page_mutex = mutex;
-    // step 2: allocate the page
-    long* pagePtr = mmap(0, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
-    check_rv((long)pagePtr);
-    // step 3: write the header to the page
-    memcpy(pagePtr, &header, sizeof(page_header_t));
-    // return the page pointer
-    return (page_header_t*)pagePtr;
+    return numChunks;
 }
 
-// To initialize the bucket allocator upon the first xmalloc call
-int initBucketAllocator()
+// To choose the slab for chunks of the given size: the fewest pages (1, 2, 4 ... SLAB_MAX_PAGES)
+// wasting at most 1/SLAB_WASTE_DIVISOR of the slab, or failing that the least wasteful one
+void slabGeometry(size_t size, int* slabPages, long* numChunks)
 {
-    // init the bucket allocator itself 
-    bucket_allocator_has_been_allocated = 1;
+    // every chunk after the first is only aligned if the class size is
+    assert(size % XMALLOC_ALIGNMENT == 0);
+    long bestWaste = 0;
+    *slabPages = 0;
+    for (int pages = 1; pages <= SLAB_MAX_PAGES; pages *= 2)
+    {
+        long slabBytes = pages * PAGE_SIZE;
+        long chunks = chunksInSlab(size, slabBytes);
+        if (chunks == 0)
+        {
+            continue;
+        }
+        long waste = slabBytes - headerBytesForChunks(chunks) - chunks * (long)size;
+        // compare waste / slabBytes across slabs without dividing
+        if (!*slabPages || waste * (*slabPages * PAGE_SIZE) < bestWaste * slabBytes)
+        {
+            *slabPages = pages;
+            *numChunks = chunks;
+            bestWaste = waste;
+        }
+        if (waste * SLAB_WASTE_DIVISOR <= slabBytes)
+        {
+            *slabPages = pages;
+            *numChunks = chunks;
+            return;
+        }
+    }
+    // a class bigger than the largest slab can never be made
+    assert(*slabPages);
+}
 
-    // init pages for each pointer: favor one-time overhead; instantiate many pages at first? 
-    for (int i = 0; i < BUCKET_NUM_BUCKETS; i++)
+// To pick where the header of the next page of the given size starts (its cache color)
+// Successive pages of a bucket step through the space left over after the chunks
+// Colors stay within the first 4 KiB, which covers every L1 and L2 set offset
+long pageColorOffset(size_t size, long leftover)
+{
+#if PAGE_CACHE_COLORING
+    int bucketIndex = sizeToBucketIndex(size);
+    unsigned long pageNumber = __atomic_fetch_add(&bucket_allocator.pages_made[bucketIndex], 1, __ATOMIC_RELAXED);
+    if (leftover >= PAGE_SIZE)
     {
-        // get the size for this bucket
-        size_t size = BUCKET_THRESHOLD_ARRAY[i];
-        // make the page
-        page_header_t* pagePtr = makeNewPage(size);
-        // store the pointer to this page in the bucket table
-        bucket_allocator.buckets[i] = pagePtr;
-        // done!
+        leftover = PAGE_SIZE - CACHE_LINE_SIZE;
     }
-    return 1;
+    long numColors = leftover / CACHE_LINE_SIZE + 1;
+    return (pageNumber % numColors) * CACHE_LINE_SIZE;
+#else
+    return 0;
+#endif
 }
 
-// To determine the index of the first free chunk in memory represented by the given bitflags
-long findFirstFreeIndexInBitflags(long* flags)
+// To take the given bytes of never-used pages, still zero, from the end of the persistent heap
+void* persistTake(size_t bytes)
 {
-    long bitsPerLong = sizeof(long) * 8;
-    // the number of longs per bitflag field is constant; iterate over each
-    for (int i = 0; i < PAGE_HEADER_NUM_BITFLAG_LONGS; i++)
-    { 
-        // get the long to consider
-        long toConsider = flags[i];
-        // proceed with this long iff it's not -1 (every bit set to 1)
-        if (toConsider != -1)
+    size_t offset = __atomic_fetch_add(&persist_heap->top, bytes, __ATOMIC_RELAXED);
+    if (offset + bytes > persist_heap->heap_bytes)
+    {
+        fprintf(stderr, "xmalloc: persistent heap %s is full\n", getenv("HMALLOC_PERSIST"));
+        abort();
+    }
+    return (void*)persist_heap + offset;
+}
+
+// To map the given bytes of zeroed pages: from the persistent heap if there is one, else anonymous
+void* mapPages(size_t bytes)
+{
+    if (persist_heap)
+    {
+        return persistTake(bytes);
+    }
+    void* pages = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check_rv((long)pages);
+    return pages;
+}
+
+// To map a slab of the given bytes with every page already faulted in
+void* mapPopulatedSlab(long slabBytes)
+{
+    void* slab = mmap(0, slabBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    check_rv((long)slab);
+    return slab;
+}
+
+// To keep each size class's reserve at its target, then sleep until the next period or a wake up
+// Targets follow demand: twice the slabs the class made in the last period, at least one
+// once the class has been used at all, so idle classes hold no memory
+void* reserveThread(void* arg)
+{
+    for (;;)
+    {
+        for (int i = 0; i < BUCKET_NUM_BUCKETS; i++)
         {
-            long ans = 0;
-            // find the first zero entry 
-            // this is NOT the most efficient way to do this but idk anything about bit twiddling
-            while (ans < bitsPerLong)
+            slab_reserve_t* reserve = &slab_reserves[i];
+            int slabPages;
+            long numChunks;
+            slabGeometry(BUCKET_THRESHOLD_ARRAY[i], &slabPages, &numChunks);
+
+            // step 1: retarget from the slabs made since the last look
+            pthread_mutex_lock(&reserve->mutex);
+            unsigned long made = reserve->made;
+            long rate = made - reserve->made_seen;
+            reserve->made_seen = made;
+            long target = made ? 2 * rate + 1 : 0;
+            reserve->target = target < RESERVE_MAX_SLABS ? target : RESERVE_MAX_SLABS;
+            int missing = reserve->target - reserve->count;
+            pthread_mutex_unlock(&reserve->mutex);
+
+            // step 2: map and fault the missing slabs outside the lock
+            for (; missing > 0; missing--)
             {
-                if ((toConsider >> ans) % 2 == 0)
-                {  
-                    // add in the indices from the longs behind this one 
-                    return (ans + (i * sizeof(long) * 8));
+                void* slab = mapPopulatedSlab((long)slabPages * PAGE_SIZE);
+                pthread_mutex_lock(&reserve->mutex);
+                int kept = reserve->count < RESERVE_MAX_SLABS;
+                if (kept)
+                {
+                    reserve->slabs[reserve->count++] = slab;
+                }
+                pthread_mutex_unlock(&reserve->mutex);
+                if (!kept)
+                {
+                    munmap(slab, (long)slabPages * PAGE_SIZE);
                 }
-                ans++;
             }
         }
+
+        // step 3: sleep until the next period, or until an allocating thread finds a reserve low
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += RESERVE_PERIOD_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&reserve_wake_mutex);
+        pthread_cond_timedwait(&reserve_wake, &reserve_wake_mutex, &until);
+        pthread_mutex_unlock(&reserve_wake_mutex);
     }
-    // bad!
-    assert(0);
+    return 0;
+}
+
+// To start the reserve thread if HMALLOC_RESERVE is set
+__attribute__((constructor))
+    void
+reserveStart()
+{
+    for (int i = 0; i < BUCKET_NUM_BUCKETS; i++)
+    {
+        pthread_mutex_init(&slab_reserves[i].mutex, 0);
+    }
+    const char* env = getenv("HMALLOC_RESERVE");
+    // reserved slabs are anonymous memory, so a persistent heap does without them
+    if (!env || !*env || strcmp(env, "0") == 0 || persist_heap)
+    {
+        return;
+    }
+    int rv = pthread_create(&reserve_thread, 0, reserveThread, 0);
+    if (rv == 0)
+    {
+        pthread_detach(reserve_thread);
+        reserve_enabled = 1;
+    }
+}
+
+// To get a zeroed slab of the given bytes for the given bucket: from its reserve when one is on hand,
+// otherwise mapped here
+void* takeSlab(int bucketIndex, long slabBytes)
+{
+    slab_reserve_t* reserve = &slab_reserves[bucketIndex];
+    void* slab = 0;
+    int low = 0;
+    if (reserve_enabled)
+    {
+        pthread_mutex_lock(&reserve->mutex);
+        reserve->made++;
+        if (reserve->count > 0)
+        {
+            slab = reserve->slabs[--reserve->count];
+        }
+        low = reserve->count * 2 < reserve->target || reserve->target == 0;
+        pthread_mutex_unlock(&reserve->mutex);
+        if (low)
+        {
+            pthread_cond_signal(&reserve_wake);
+        }
+    }
+    if (!slab)
+    {
+        slab = mapPages(slabBytes);
+    }
+    return slab;
+}
+
+// To initialize a new slab with chunks of the given size
+// The header sits at the slab's color offset, with its chunks right after it
+page_header_t* makeNewPage(size_t size, int hint)
+{
+    // step 1: pick the slab size and chunk count for this size
+    int slabPages;
+    long numChunks;
+    slabGeometry(size, &slabPages, &numChunks);
+    long slabBytes = (long)slabPages * PAGE_SIZE;
+    long leftover = slabBytes - headerBytesForChunks(numChunks) - numChunks * (long)size;
+    // step 2: allocate the slab; the bitflags and every chunk are still zero from mmap
+    void* pagePtr = takeSlab(sizeToBucketIndex(size), slabBytes);
+    // step 3: fill in the header at its color offset
+    page_header_t* headerPtr = (page_header_t*)(pagePtr + pageColorOffset(size, leftover));
+    // set the size for each chunk in this page as the size for this bucket
+    headerPtr->page_chunks_size = size;
+    // the caller lists the page
+    headerPtr->next_page = 0;
+    headerPtr->page_listed = 0;
+    // nothing has been handed out yet
+    headerPtr->page_fresh_index = 0;
+    // remember which page set this page belongs to
+    headerPtr->page_hint = hint;
+    headerPtr->page_num_chunks = numChunks;
+    headerPtr->page_slab_pages = slabPages;
+    int rv = pthread_mutex_init(&headerPtr->page_mutex, 0);
+    check_rv(rv);
+    // step 4: publish every page of the slab in the page map so xfree can classify its chunks
+    for (int i = 0; i < slabPages; i++)
+    {
+        pageMapSet(pagePtr + (long)i * PAGE_SIZE, (page_map_entry_t)headerPtr | PAGE_MAP_SMALL);
+    }
+    // return the page header pointer
+    return headerPtr;
 }
 
 // To calculate the address of the chunk to allocate within the given page at the given address
@@ -257,7 +629,7 @@ long* calculateAddressToAlloc(page_header_t* page, long firstFreeIndex)
     size_t size = page->page_chunks_size;
     offset += (firstFreeIndex * size);
     // add the header size
-    offset += sizeof(page_header_t);
+    offset += headerBytesForChunks(page->page_num_chunks);
     // return the offset plus the page base address
     long pageAddress = (long)page;
     long returnAddress = pageAddress + offset;
@@ -274,152 +646,836 @@ void toggleBitflags(page_header_t* page_header, long index)
     page_header->bitflags[bitflag_number] ^= (long)1 << bitflag_index;
 }
 
-// To allocate a chunk in the given page, or to create a new page of the same allocation size if this page is full
-void* allocInPage(page_header_t* page, size_t sizeOfAllocation)
-{  
-    // step 1: get the bitflags
-    long* flags = page->bitflags;
-    // step 2: find the index of the first free chunk
-    long firstFreeIndex = findFirstFreeIndexInBitflags(flags);
-    // step 3: calculate the address of the memory to allocate
-    long* addressToAlloc = calculateAddressToAlloc(page, firstFreeIndex);
-    // step 4: write the header to the chunk
-    data_chunk_header_t* chunkHeader = (data_chunk_header_t*)addressToAlloc;
-    // write the page addres at the chunk
-    chunkHeader->page_header_address = page;
-    // step 5: change the bitflags 
-    pthread_mutex_lock(&page->page_mutex);
-    toggleBitflags(page, firstFreeIndex); 
-    pthread_mutex_unlock(&page->page_mutex);
-    // return the chunk header pointer
-    return chunkHeader;
-}
-
-// To determine if there is any free space in the given page
-int isSpaceInPage(page_header_t* pageHeader)
-{
-    // step 1: get the page size
-    size_t chunkSize = pageHeader->page_chunks_size;
-    // step 2: determine the number of chunks in the page
-    long usablePageSpace = 4096 - sizeof(page_header_t);
-    long numChunks = usablePageSpace / chunkSize;  // round down- int division is good
-    // step 3: check that number of bits
-    for (int i = 0; i < numChunks; i++)
-    { 
-        // get the long to check 
-        long bitfieldLongToCheck = i / NUM_BITS_PER_LONG;
-        // get the index within the long to check 
-        long bitfieldIndex = i % NUM_BITS_PER_LONG;
-        // check if the bit at that location is 0 
-        long longToCheck = pageHeader->bitflags[bitfieldLongToCheck];
-        long is0 = (longToCheck >> bitfieldIndex) & 1; 
-        // if this is 0, the bit at that location is 0; there is space
-        if (!is0)
+// To determine the number of chunks that fit in the given page
+long chunksInPage(page_header_t* page)
+{
+    return page->page_num_chunks;
+}
+
+// To claim the first free chunk in the given page, returning its index or -1 if the page is full
+// fresh is set if the chunk has never been handed out since the page was mapped
+// The page mutex must be held by the caller
+long claimFreeChunk(page_header_t* page, int* fresh)
+{
+    // step 1: determine the number of chunks in the page
+    long numChunks = chunksInPage(page);
+    // step 2: find the first zero bit that maps to a real chunk
+    long numLongs = (numChunks + NUM_BITS_PER_LONG - 1) / NUM_BITS_PER_LONG;
+    for (int i = 0; i < numLongs; i++)
+    {
+        long toConsider = page->bitflags[i];
+        if (toConsider != -1)
+        {
+            long index = __builtin_ctzl(~toConsider) + (i * NUM_BITS_PER_LONG);
+            if (index >= numChunks)
+            {
+                return -1;
+            }
+            // step 3: mark it allocated
+            toggleBitflags(page, index);
+            // step 4: chunks are claimed lowest first, so only the high water mark can be fresh
+            *fresh = (index >= page->page_fresh_index);
+            if (*fresh)
+            {
+                page->page_fresh_index = index + 1;
+            }
+            return index;
+        }
+    }
+    return -1;
+}
+
+// To return a page of the given bucket with a free chunk, claiming a chunk in it
+// O(1): the head of the bucket's list has room unless a page filled up since its last claim,
+// and a full page leaves the list for good until a free makes room in it (see freeChunkInPage)
+page_header_t* findFirstFreePageOfBucket(int bucketIndex, int hint, long* claimedIndex, int* fresh)
+{
+    pthread_mutex_t* bucketMutex = &bucket_mutexes[hint][bucketIndex];
+    page_header_t** head = &bucket_allocator.buckets[hint][bucketIndex];
+    pthread_mutex_lock(bucketMutex);
+    for (;;)
+    {
+        page_header_t* pageHeader = *head;
+        // step 1: with no page listed, make one without holding the lock, then list it
+        if (!pageHeader)
+        {
+            pthread_mutex_unlock(bucketMutex);
+            page_header_t* newPage = makeNewPage(BUCKET_THRESHOLD_ARRAY[bucketIndex], hint);
+            pthread_mutex_lock(bucketMutex);
+            newPage->next_page = *head;
+            __atomic_store_n(&newPage->page_listed, 1, __ATOMIC_RELAXED);
+            *head = newPage;
+            continue;
+        }
+        // step 2: claim a chunk in the head page
+        pthread_mutex_lock(&pageHeader->page_mutex);
+        long index = claimFreeChunk(pageHeader, fresh);
+        if (index >= 0)
+        {
+            pthread_mutex_unlock(&pageHeader->page_mutex);
+            pthread_mutex_unlock(bucketMutex);
+            *claimedIndex = index;
+            return pageHeader;
+        }
+        // step 3: the page is full, so it leaves the list; clearing the flag under the page mutex
+        // means the next free in this page sees it and lists the page again
+        *head = pageHeader->next_page;
+        pageHeader->next_page = 0;
+        __atomic_store_n(&pageHeader->page_listed, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pageHeader->page_mutex);
+    }
+}
+
+// To pick the bin for a free run of the given number of pages
+int runBinIndex(long npages)
+{
+    return npages < RUN_NUM_BINS ? npages - 1 : RUN_NUM_BINS - 1;
+}
+
+// To mark the free run of npages at the given address in the page map and file it in its bin
+// The run mutex must be held by the caller
+void runBinPush(void* run, long npages)
+{
+    page_map_entry_t entry = (npages << 3) | PAGE_MAP_RUN_FREE | PAGE_MAP_RUN;
+    pageMapSet(run, entry);
+    pageMapSet(run + (npages - 1) * PAGE_SIZE, entry);
+
+    int bin = runBinIndex(npages);
+    run_node_t* node = (run_node_t*)run;
+    node->npages = npages;
+    node->prev = 0;
+    node->next = run_allocator.bins[bin];
+    if (node->next)
+    {
+        node->next->prev = node;
+    }
+    run_allocator.bins[bin] = node;
+    run_allocator.bin_bits[bin / 64] |= 1UL << (bin % 64);
+}
+
+// To take the given free run out of its bin and clear its page map entries
+// The run mutex must be held by the caller
+void runBinRemove(run_node_t* node)
+{
+    int bin = runBinIndex(node->npages);
+    if (node->prev)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        run_allocator.bins[bin] = node->next;
+        if (!node->next)
+        {
+            run_allocator.bin_bits[bin / 64] &= ~(1UL << (bin % 64));
+        }
+    }
+    if (node->next)
+    {
+        node->next->prev = node->prev;
+    }
+    pageMapSet(node, 0);
+    pageMapSet((void*)node + (node->npages - 1) * PAGE_SIZE, 0);
+}
+
+// To find the smallest free run of at least npages, or null if there is none
+// The run mutex must be held by the caller
+run_node_t* runBestFit(long npages)
+{
+    int bin = runBinIndex(npages);
+    while (bin < RUN_NUM_BINS)
+    {
+        // skip to the next non-empty bin
+        unsigned long bits = run_allocator.bin_bits[bin / 64] >> (bin % 64);
+        if (!bits)
         {
-            return 1;
+            bin = (bin / 64 + 1) * 64;
+            continue;
         }
+        bin += __builtin_ctzl(bits);
+        if (bin < RUN_NUM_BINS - 1)
+        {
+            return run_allocator.bins[bin];
+        }
+        // the last bin is unsorted: take the closest fit
+        run_node_t* best = 0;
+        for (run_node_t* node = run_allocator.bins[bin]; node; node = node->next)
+        {
+            if (node->npages >= npages && (!best || node->npages < best->npages))
+            {
+                best = node;
+            }
+        }
+        return best;
     }
-    // no space; return 0
     return 0;
 }
 
-// To return the first free page in the allocator of the given size
-page_header_t* findFirstFreePageOfSize(size_t size)
+// To release the free run of npages at the given address, merging it with free neighbours
+// The run mutex must be held by the caller
+void runRelease(void* run, long npages)
 {
-    // step 1: obtain the index of the bucket to use in the bucket list
-    int bucketIndex = sizeToBucketIndex(size);
+    // step 1: the page before may be the last page of a free run
+    page_map_entry_t before = pageMapGet(run - PAGE_SIZE);
+    if ((before & (PAGE_MAP_TAG_MASK | PAGE_MAP_RUN_FREE)) == (PAGE_MAP_RUN_FREE | PAGE_MAP_RUN))
+    {
+        long beforePages = before >> 3;
+        run -= beforePages * PAGE_SIZE;
+        runBinRemove((run_node_t*)run);
+        npages += beforePages;
+    }
+    // step 2: the page after may be the first page of a free run
+    page_map_entry_t after = pageMapGet(run + npages * PAGE_SIZE);
+    if ((after & (PAGE_MAP_TAG_MASK | PAGE_MAP_RUN_FREE)) == (PAGE_MAP_RUN_FREE | PAGE_MAP_RUN))
+    {
+        run_node_t* next = (run_node_t*)(run + npages * PAGE_SIZE);
+        npages += next->npages;
+        runBinRemove(next);
+    }
+    // step 3: file the merged run
+    runBinPush(run, npages);
+}
 
-    pthread_mutex_t lock;
-    // step 2: get the first page of that size
-    page_header_t* pageHeader = bucket_allocator.buckets[bucketIndex]; 
-    // step 3: iterate over the linked list of pages until one with free space is found
-    while(!isSpaceInPage(pageHeader))
-    {
-        page_header_t* previousHeader = pageHeader;
-        pageHeader = pageHeader->next_page;
-        // if this is null, make a new page
-        lock = previousHeader->page_mutex;
-        pthread_mutex_lock(&lock);
-        // must lock here!
-        if (!pageHeader)
+// To allocate a run of npages contiguous pages
+// fresh is set if the run is still zero from mmap
+void* allocRun(long npages, int* fresh)
+{
+    pthread_mutex_lock(&run_allocator.run_mutex);
+    // step 1: best fit among the free runs, giving back what is not needed
+    void* run = runBestFit(npages);
+    if (run)
+    {
+        long runPages = ((run_node_t*)run)->npages;
+        runBinRemove((run_node_t*)run);
+        if (runPages > npages)
         {
-            page_header_t* newPage = makeNewPage(previousHeader->page_chunks_size);
-            // link this page to the previous page 
-            previousHeader->next_page = newPage;
-            // free the lock
-            // return the new page
-            pageHeader = newPage;
-            break;
+            runBinPush(run + npages * PAGE_SIZE, runPages - npages);
+        }
+        *fresh = 0;
+    }
+    else
+    {
+        // step 2: carve from the untouched end of the newest region, mapping a new one if it is too short
+        // (only a persistent heap asks for runs longer than a region)
+        if (run_allocator.wild_start + npages * PAGE_SIZE > run_allocator.wild_end)
+        {
+            if (run_allocator.wild_start < run_allocator.wild_end)
+            {
+                runRelease(run_allocator.wild_start, (run_allocator.wild_end - run_allocator.wild_start) / PAGE_SIZE);
+            }
+            long regionPages = npages > RUN_REGION_PAGES ? npages : RUN_REGION_PAGES;
+            void* region = mapPages(regionPages * PAGE_SIZE);
+            run_allocator.wild_start = region;
+            run_allocator.wild_end = region + regionPages * PAGE_SIZE;
         }
+        run = run_allocator.wild_start;
+        run_allocator.wild_start += npages * PAGE_SIZE;
+        *fresh = 1;
     }
-    pthread_mutex_unlock(&lock);
-    // return that page
-    return pageHeader;
+    // step 3: publish the run so xfree knows its length
+    pageMapSet(run, (npages << 3) | PAGE_MAP_RUN);
+    pthread_mutex_unlock(&run_allocator.run_mutex);
+    return run;
 }
 
+// To free the page run at the given pointer, whose page map entry the caller has looked up
+void freeRun(void* ptr, page_map_entry_t entry)
+{
+    pthread_mutex_lock(&run_allocator.run_mutex);
+    // a racing double free may have released the run since the caller looked
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) != 0 || (entry & PAGE_MAP_RUN_FREE) || pageMapGet(ptr) != entry)
+    {
+        pthread_mutex_unlock(&run_allocator.run_mutex);
+        reportBadPointer("xfree", ptr);
+    }
+    runRelease(ptr, entry >> 3);
+    pthread_mutex_unlock(&run_allocator.run_mutex);
+}
+
+// To allocate at least the given number of bytes from the given hint's page set,
+// storing the usable capacity in actual
+// fresh is set if the returned memory is still zero from mmap
+void* allocChunk(size_t bytes, int hint, size_t* actual, int* fresh)
+{
+    if (profile_enabled)
+    {
+        profileRecord(bytes);
+    }
+    // step 1: determine if this allocation is too big for the buckets
+    if (largerThanPage(bytes))
+    {
+        // the page map remembers the length, so no header is needed; round the request up to whole pages
+        size_t mapSize = (bytes + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+        // medium sizes come from a page run, as does everything in a persistent heap
+        if (mapSize <= RUN_MAX_PAGES * PAGE_SIZE || persist_heap)
+        {
+            *actual = mapSize;
+            return allocRun(mapSize / PAGE_SIZE, fresh);
+        }
+        // anything bigger is worth a direct syscall allocation
+        void* direct_page = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+        check_rv((long)direct_page);
+        // record the length of the mapping against its first page
+        pageMapSet(direct_page, ((mapSize / PAGE_SIZE) << 2) | PAGE_MAP_LARGE);
+        *actual = mapSize;
+        *fresh = 1;
+        return direct_page;
+    }
+
+    // step 2: get the first free page for this size allocation, claiming a chunk in it
+    long claimedIndex;
+    page_header_t* firstFreePage = findFirstFreePageOfBucket(sizeToBucketIndex(bytes), hint, &claimedIndex, fresh);
+    // step 3: return the claimed chunk; the page map, not the chunk, records which page it is in
+    *actual = firstFreePage->page_chunks_size;
+    return calculateAddressToAlloc(firstFreePage, claimedIndex);
+}
+
+// To allocate at least the given number of bytes, storing the usable capacity in actual if non-null
     void*
-xmalloc(size_t bytes)
+xmalloc_at_least(size_t bytes, size_t* actual)
 {
-    // step -1: determine if the bucket system needs to be instantiated
-    // this runs on the very first xmalloc call
-    if (bucket_allocator_has_been_allocated == 0)
+    size_t usable;
+    int fresh;
+    void* ptr = allocChunk(bytes, XMALLOC_HINT_DEFAULT, &usable, &fresh);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    if (actual)
     {
-        initBucketAllocator();
+        *actual = usable;
     }
-    // step 0: prepend (sizeof(size_t)) bytes onto the size
-    bytes += sizeof(size_t);
-    // step 1: determine if this allocation is big enough for a direct syscall allocation
-    int mmapDirectly = largerThanPage(bytes);
-    // if so, do it
-    if (mmapDirectly)
+    return ptr;
+}
+
+// To allocate zeroed memory for an array of nmemb elements of the given size
+    void*
+xcalloc(size_t nmemb, size_t bytes)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, bytes, &total))
     {
-        // retrieve the pointer to memory, adding sizeof(long) to the mapping because of the key
-        direct_map_page_t* direct_page = mmap(0, bytes + sizeof(long), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
-        // write the size at the beginning
-        direct_page->size = bytes;
-        direct_page->key = 1234567;
-        // return a pointer to the memory after the size field
-        return ((void*)direct_page + sizeof(direct_map_page_t));
+        return 0;
     }
+    size_t usable;
+    int fresh;
+    void* ptr = allocChunk(total, XMALLOC_HINT_DEFAULT, &usable, &fresh);
+    // memory untouched since mmap is already zero; directly mapped blocks are never faulted in here
+    // recycled chunks are cleared with memset, which uses the widest stores the CPU offers
+    if (!fresh)
+    {
+        memset(ptr, 0, total);
+    }
+    XTRACE(xtrace_alloc(XTRACE_CALLOC, ptr, total));
+    return ptr;
+}
 
-    // step 2: get the pointer to the first free for this size allocation
-    page_header_t* firstFreePage = findFirstFreePageOfSize(bytes);  
-    // step 3: allocate the data 
-    long* ptrToHeaderOfAllocData = allocInPage(firstFreePage, bytes);
-    // step 4: return a pointer to the data after the header 
-    long* ptrToData = (long*) ((long)ptrToHeaderOfAllocData + sizeof(data_chunk_header_t));  
-    return ptrToData;
+// To determine the number of bytes usable at the given allocation
+    size_t
+xmalloc_usable_size(void* ptr)
+{
+    page_map_entry_t entry = pageMapGet(ptr);
+    if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_RUN && !(entry & PAGE_MAP_RUN_FREE))
+    {
+        return (entry >> 3) * PAGE_SIZE;
+    }
+    if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_LARGE)
+    {
+        return (entry >> 2) * PAGE_SIZE;
+    }
+    if ((entry & PAGE_MAP_TAG_MASK) != PAGE_MAP_SMALL)
+    {
+        reportBadPointer("xmalloc_usable_size", ptr);
+    }
+    page_header_t* page_header = (page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK);
+    return page_header->page_chunks_size;
 }
 
-    void
-xfree(void* ptr)
-{   
-    direct_map_page_t direct_map = *((direct_map_page_t*)(ptr - sizeof(direct_map_page_t)));
-    // check if the allocated memory is directly mapped 
-    if (direct_map.key == 1234567) {
-        munmap(ptr - sizeof(direct_map_page_t), direct_map.size);
-        return;
+    void*
+xmalloc(size_t bytes)
+{
+    size_t usable;
+    int fresh;
+    void* ptr = allocChunk(bytes, XMALLOC_HINT_DEFAULT, &usable, &fresh);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+// To allocate memory on the pages kept for the given lifetime hint (XMALLOC_HINT_*)
+    void*
+xmalloc_hint(size_t bytes, int flags)
+{
+    if (flags < 0 || flags >= XMALLOC_NUM_HINTS)
+    {
+        flags = XMALLOC_HINT_DEFAULT;
     }
+    size_t usable;
+    int fresh;
+    void* ptr = allocChunk(bytes, flags, &usable, &fresh);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
 
-    data_chunk_header_t* old_chunk_header = (data_chunk_header_t*)(ptr - sizeof(data_chunk_header_t));
-    page_header_t* old_page_header = old_chunk_header->page_header_address;
-    long address_gap = (((long)(old_chunk_header)) - 
-            ((long)((void*)old_page_header + sizeof(page_header_t))));
-    long chunk_index = address_gap / old_page_header->page_chunks_size;
+// To release the chunk at the given pointer back to the given page
+void freeChunkInPage(page_header_t* old_page_header, void* ptr)
+{
+    long address_gap = ((long)ptr) -
+            ((long)((void*)old_page_header + headerBytesForChunks(old_page_header->page_num_chunks)));
+    long chunk_index = address_gap / (long)old_page_header->page_chunks_size;
+    // the pointer must be the start of a chunk
+    if (address_gap < 0 || address_gap % (long)old_page_header->page_chunks_size != 0
+            || chunk_index >= chunksInPage(old_page_header)) {
+        reportBadPointer("xfree", ptr);
+    }
 
     // bitwise and of the bitflag with 1*01*, setting the index bit of this chunk to 0
     pthread_mutex_lock(&old_page_header->page_mutex);
-    toggleBitflags(old_page_header, chunk_index);  
+    long bit = (old_page_header->bitflags[chunk_index / NUM_BITS_PER_LONG] >> (chunk_index % NUM_BITS_PER_LONG)) & 1;
+    if (bit) {
+        toggleBitflags(old_page_header, chunk_index);  
+    }
+    int listed = __atomic_load_n(&old_page_header->page_listed, __ATOMIC_RELAXED);
     pthread_mutex_unlock(&old_page_header->page_mutex);
+    // a clear bit means the chunk is already free
+    if (!bit) {
+        reportBadPointer("xfree", ptr);
+    }
+
+    // a page that left its bucket's list when it filled up has room again: list it
+    // (the bucket mutex comes first, so it is taken only once the page mutex is released)
+    if (!listed) {
+        int hint = old_page_header->page_hint;
+        int bucketIndex = sizeToBucketIndex(old_page_header->page_chunks_size);
+        pthread_mutex_lock(&bucket_mutexes[hint][bucketIndex]);
+        if (!__atomic_load_n(&old_page_header->page_listed, __ATOMIC_RELAXED)) {
+            old_page_header->next_page = bucket_allocator.buckets[hint][bucketIndex];
+            __atomic_store_n(&old_page_header->page_listed, 1, __ATOMIC_RELAXED);
+            bucket_allocator.buckets[hint][bucketIndex] = old_page_header;
+        }
+        pthread_mutex_unlock(&bucket_mutexes[hint][bucketIndex]);
+    }
+}
+
+// To release the chunk or direct mapping at the given pointer
+void freeChunk(void* ptr)
+{   
+    // classify the pointer from the page map alone, without touching the memory around it
+    page_map_entry_t entry = pageMapGet(ptr);
+
+    // check if the allocated memory is a page run
+    if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_RUN) {
+        freeRun(ptr, entry);
+        return;
+    }
+    // check if the allocated memory is directly mapped 
+    if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_LARGE) {
+        if (((uintptr_t)ptr & (PAGE_SIZE - 1)) != 0) {
+            reportBadPointer("xfree", ptr);
+        }
+        pageMapSet(ptr, 0);
+        munmap(ptr, (entry >> 2) * PAGE_SIZE);
+        return;
+    }
+    if ((entry & PAGE_MAP_TAG_MASK) != PAGE_MAP_SMALL) {
+        reportBadPointer("xfree", ptr);
+    }
+
+    freeChunkInPage((page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK), ptr);
+}
+
+    void
+xfree(void* ptr)
+{
+    XTRACE(xtrace_free(ptr));
+    freeChunk(ptr);
+}
+
+// To allocate bytes known at compile time to fall in the given bucket (see xmalloc_fast.h)
+    void*
+xmalloc_class(int cls, size_t bytes, int hint)
+{
+    if (profile_enabled)
+    {
+        profileRecord(bytes);
+    }
+    if (hint < 0 || hint >= XMALLOC_NUM_HINTS)
+    {
+        hint = XMALLOC_HINT_DEFAULT;
+    }
+    long claimedIndex;
+    int fresh;
+    page_header_t* page = findFirstFreePageOfBucket(cls, hint, &claimedIndex, &fresh);
+    void* ptr = calculateAddressToAlloc(page, claimedIndex);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+// To free a chunk that the caller knows is in one of the buckets
+// The page map still has the last word, so bad pointers are caught as in xfree
+void freeBucketChunk(void* ptr)
+{
+    page_map_entry_t entry = pageMapGet(ptr);
+    if ((entry & PAGE_MAP_TAG_MASK) != PAGE_MAP_SMALL) {
+        reportBadPointer("xfree", ptr);
+    }
+    freeChunkInPage((page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK), ptr);
 }
 
+// To free a chunk known at compile time to be in one of the buckets
+// No cheaper than xfree: the page map lookup is the whole cost of finding the page
+    void
+xfree_class(void* ptr)
+{
+    XTRACE(xtrace_free(ptr));
+    freeBucketChunk(ptr);
+}
+
+// To free a block whose requested size the caller knows, as C++ sized delete does
+// The size only decides between the bucket and page paths
+    void
+xfree_sized(void* ptr, size_t bytes)
+{
+    XTRACE(xtrace_free(ptr));
+    if (largerThanPage(bytes)) {
+        freeChunk(ptr);
+        return;
+    }
+    freeBucketChunk(ptr);
+}
 
     void*
 xrealloc(void* prev, size_t bytes)
 {
-    void* out = xmalloc(bytes);
-    memcpy(out, prev, bytes);
-    xfree(prev);
+    uint32_t old_id = 0;
+    XTRACE(old_id = xtrace_realloc_begin(prev));
+
+    // the chunk may already be big enough for the new size
+    size_t usable = xmalloc_usable_size(prev);
+    void* out = prev;
+    if (bytes > usable) {
+        // keep the block in the same page set it started in
+        page_map_entry_t entry = pageMapGet(prev);
+        int hint = XMALLOC_HINT_DEFAULT;
+        if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_SMALL) {
+            hint = ((page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK))->page_hint;
+        }
+        size_t outUsable;
+        int fresh;
+        out = allocChunk(bytes, hint, &outUsable, &fresh);
+        memcpy(out, prev, usable);
+        freeChunk(prev);
+    }
+
+    XTRACE(xtrace_realloc_end(old_id, out, bytes));
     return out;
 }
 
+// To write the slab whose header is given to the snapshot, locking it only to copy its bitmap
+void snapshotSlab(hmsnap_writer* writer, void* slabStart, page_header_t* page)
+{
+    long numLongs = (page->page_num_chunks + NUM_BITS_PER_LONG - 1) / NUM_BITS_PER_LONG;
+    uint64_t bitmap[numLongs];
+    long used = 0;
+    pthread_mutex_lock(&page->page_mutex);
+    for (int i = 0; i < numLongs; i++)
+    {
+        bitmap[i] = page->bitflags[i];
+        used += __builtin_popcountl(page->bitflags[i]);
+    }
+    pthread_mutex_unlock(&page->page_mutex);
+
+    hmsnap_record rec = { 0 };
+    rec.kind = HMSNAP_SLAB;
+    rec.owner = page->page_hint;
+    rec.chunk_size = page->page_chunks_size;
+    rec.addr = (uintptr_t)slabStart;
+    rec.bytes = (uint64_t)page->page_slab_pages * PAGE_SIZE;
+    rec.chunks = page->page_num_chunks;
+    rec.used = used;
+    rec.first = (void*)page + headerBytesForChunks(page->page_num_chunks) - slabStart;
+    hmsnap_put(writer, &rec, bitmap);
+}
+
+// To write a snapshot of the heap to the given file (see hmsnap.h), returning 0 on success
+// Walks the page map, so every slab, run and direct mapping is found without a global lock
+    int
+xmalloc_snapshot(const char* path)
+{
+    hmsnap_writer writer;
+    if (hmsnap_open(&writer, path, "par", PAGE_SIZE) == -1)
+    {
+        return -1;
+    }
+
+    // step 1: the untouched tail of the newest run region
+    hmsnap_record rec = { 0 };
+    pthread_mutex_lock(&run_allocator.run_mutex);
+    rec.addr = (uintptr_t)run_allocator.wild_start;
+    rec.bytes = run_allocator.wild_end - run_allocator.wild_start;
+    pthread_mutex_unlock(&run_allocator.run_mutex);
+    if (rec.bytes)
+    {
+        rec.kind = HMSNAP_FREE_RUN;
+        rec.flags = HMSNAP_FRESH;
+        hmsnap_put(&writer, &rec, 0);
+    }
+
+    // step 2: every page the page map knows, skipping the rest of each slab, run or mapping found
+    uintptr_t resume = 0;
+    for (size_t i = 0; i < PAGE_MAP_ROOT_ENTRIES; i++)
+    {
+        page_map_entry_t* leaf = __atomic_load_n(&page_map_root[i], __ATOMIC_ACQUIRE);
+        if (!leaf)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < PAGE_MAP_LEAF_ENTRIES; j++)
+        {
+            uintptr_t addr = ((i << PAGE_MAP_LEAF_BITS) | j) << PAGE_MAP_PAGE_SHIFT;
+            page_map_entry_t entry = __atomic_load_n(&leaf[j], __ATOMIC_ACQUIRE);
+            if (!entry || addr < resume)
+            {
+                continue;
+            }
+            memset(&rec, 0, sizeof(rec));
+            rec.addr = addr;
+            switch (entry & PAGE_MAP_TAG_MASK)
+            {
+            case PAGE_MAP_SMALL:
+            {
+                page_header_t* page = (page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK);
+                // the header is in the first page of its slab
+                if (((uintptr_t)page & ~((uintptr_t)PAGE_SIZE - 1)) == addr)
+                {
+                    snapshotSlab(&writer, (void*)addr, page);
+                    resume = addr + (uintptr_t)page->page_slab_pages * PAGE_SIZE;
+                }
+                continue;
+            }
+            case PAGE_MAP_LARGE:
+                rec.kind = HMSNAP_LARGE;
+                rec.bytes = (entry >> 2) * PAGE_SIZE;
+                rec.used = 1;
+                break;
+            case PAGE_MAP_RUN:
+                rec.kind = (entry & PAGE_MAP_RUN_FREE) ? HMSNAP_FREE_RUN : HMSNAP_RUN;
+                rec.bytes = (entry >> 3) * PAGE_SIZE;
+                break;
+            }
+            hmsnap_put(&writer, &rec, 0);
+            resume = addr + rec.bytes;
+        }
+    }
+
+    return hmsnap_close(&writer);
+}
+
+// To make the allocator state what it was at the persistent heap's last clean exit
+void persistRestore()
+{
+    bucket_allocator = persist_heap->buckets;
+    memcpy(run_allocator.bins, persist_heap->bins, sizeof(run_allocator.bins));
+    memcpy(run_allocator.bin_bits, persist_heap->bin_bits, sizeof(run_allocator.bin_bits));
+    run_allocator.wild_start = persist_heap->wild_start;
+    run_allocator.wild_end = persist_heap->wild_end;
+}
+
+// To rebuild the bucket page lists and the free runs of a persistent heap whose last user did not
+// exit cleanly, from the page map in the file
+// Every slab's mutex is reset, since the process that died may have held it; pages the page map
+// does not know (a slab or region taken but never published) become free runs
+void persistRecover()
+{
+    page_header_t* tails[XMALLOC_NUM_HINTS][BUCKET_NUM_BUCKETS] = { { 0 } };
+    void* addr = (void*)persist_heap + PERSIST_HEADER_BYTES + persist_heap->heap_bytes / PAGE_MAP_LEAF_SPAN * PAGE_MAP_LEAF_BYTES;
+    void* end = (void*)persist_heap + persist_heap->top;
+    void* freeStart = 0;
+    while (addr < end)
+    {
+        page_map_entry_t entry = pageMapGet(addr);
+        // step 1: free runs and unknown pages join the free stretch being gathered
+        if (!entry)
+        {
+            freeStart = freeStart ? freeStart : addr;
+            addr += PAGE_SIZE;
+            continue;
+        }
+        if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_RUN && (entry & PAGE_MAP_RUN_FREE))
+        {
+            long npages = entry >> 3;
+            pageMapSet(addr, 0);
+            pageMapSet(addr + (npages - 1) * PAGE_SIZE, 0);
+            freeStart = freeStart ? freeStart : addr;
+            addr += npages * PAGE_SIZE;
+            continue;
+        }
+        // step 2: anything in use ends the stretch, which is filed as one free run
+        if (freeStart)
+        {
+            runRelease(freeStart, (addr - freeStart) / PAGE_SIZE);
+            freeStart = 0;
+        }
+        // step 3: append each slab with a free chunk to its bucket's list and skip past it; skip past each run
+        if ((entry & PAGE_MAP_TAG_MASK) == PAGE_MAP_SMALL)
+        {
+            page_header_t* page = (page_header_t*)(entry & ~(page_map_entry_t)PAGE_MAP_TAG_MASK);
+            int bucketIndex = sizeToBucketIndex(page->page_chunks_size);
+            int rv = pthread_mutex_init(&page->page_mutex, 0);
+            check_rv(rv);
+            page->next_page = 0;
+            long numLongs = (page->page_num_chunks + NUM_BITS_PER_LONG - 1) / NUM_BITS_PER_LONG;
+            long used = 0;
+            for (int i = 0; i < numLongs; i++)
+            {
+                used += __builtin_popcountl(page->bitflags[i]);
+            }
+            // a full slab stays off the list until a free makes room in it
+            page->page_listed = used < page->page_num_chunks;
+            if (page->page_listed)
+            {
+                if (tails[page->page_hint][bucketIndex])
+                {
+                    tails[page->page_hint][bucketIndex]->next_page = page;
+                }
+                else
+                {
+                    bucket_allocator.buckets[page->page_hint][bucketIndex] = page;
+                }
+                tails[page->page_hint][bucketIndex] = page;
+            }
+            bucket_allocator.pages_made[bucketIndex]++;
+            addr += (long)page->page_slab_pages * PAGE_SIZE;
+        }
+        else
+        {
+            addr += (entry >> 3) * PAGE_SIZE;
+        }
+    }
+    if (freeStart)
+    {
+        runRelease(freeStart, (end - freeStart) / PAGE_SIZE);
+    }
+}
+
+// To map the persistent heap if HMALLOC_PERSIST names a file, creating it if it does not exist
+// A heap left by a clean exit resumes from its saved state; any other is recovered first
+// Runs before the other constructors, so every page this process hands out comes from the file
+__attribute__((constructor(101)))
+    void
+persistStart()
+{
+    const char* path = getenv("HMALLOC_PERSIST");
+    if (!path || !*path)
+    {
+        return;
+    }
+    // step 1: open the file, sizing a new one (sparsely) on the way
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    check_rv(fd);
+    struct stat st;
+    check_rv(fstat(fd, &st));
+    int created = (st.st_size == 0);
+    size_t heapBytes = created ? PERSIST_HEAP_BYTES : (size_t)st.st_size;
+    if (created)
+    {
+        check_rv(ftruncate(fd, heapBytes));
+    }
+    // step 2: map it at the fixed base, which nothing else may occupy
+    // Kernels before 4.17 take MAP_FIXED_NOREPLACE as a hint, so the mapping may land anywhere;
+    // the pointers in the file would be wrong there, so the heap stays volatile instead
+    void* base = mmap((void*)PERSIST_BASE, heapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    check_rv((long)base);
+    if (base != (void*)PERSIST_BASE)
+    {
+        fprintf(stderr, "xmalloc: cannot map %s at %p; the heap is not persistent\n", path, (void*)PERSIST_BASE);
+        munmap(base, heapBytes);
+        // a file made here goes back to empty, so the next run sets it up afresh
+        if (created)
+        {
+            check_rv(ftruncate(fd, 0));
+        }
+        close(fd);
+        return;
+    }
+    close(fd);
+    persist_header_t* header = (persist_header_t*)base;
+    // step 3: set up a new heap, or check that an old one was built with these size classes
+    if (created)
+    {
+        memcpy(header->magic, PERSIST_MAGIC, sizeof(header->magic));
+        header->heap_bytes = heapBytes;
+        header->num_buckets = BUCKET_NUM_BUCKETS;
+        memcpy(header->classes, BUCKET_THRESHOLD_ARRAY, sizeof(header->classes));
+        header->top = PERSIST_HEADER_BYTES + heapBytes / PAGE_MAP_LEAF_SPAN * PAGE_MAP_LEAF_BYTES;
+    }
+    else if (memcmp(header->magic, PERSIST_MAGIC, sizeof(header->magic)) != 0
+            || header->heap_bytes != heapBytes || heapBytes % PAGE_MAP_LEAF_SPAN != 0
+            || header->num_buckets != BUCKET_NUM_BUCKETS
+            || memcmp(header->classes, BUCKET_THRESHOLD_ARRAY, sizeof(header->classes)) != 0)
+    {
+        fprintf(stderr, "xmalloc: %s is not a persistent heap built with these size classes\n", path);
+        abort();
+    }
+    // step 4: the page map leaves for the heap's address range are the ones in the file
+    page_map_entry_t* leaves = base + PERSIST_HEADER_BYTES;
+    for (size_t i = 0; i < heapBytes / PAGE_MAP_LEAF_SPAN; i++)
+    {
+        page_map_root[(PERSIST_BASE >> (PAGE_MAP_LEAF_BITS + PAGE_MAP_PAGE_SHIFT)) + i] = leaves + i * PAGE_MAP_LEAF_ENTRIES;
+    }
+    // step 5: resume or recover, then mark the heap open until a clean exit
+    persist_heap = header;
+    if (!created && header->clean)
+    {
+        persistRestore();
+    }
+    else if (!created)
+    {
+        persistRecover();
+    }
+    header->clean = 0;
+}
+
+// To save the allocator state in the persistent heap and mark it clean, once the heap is on disk
+__attribute__((destructor))
+    void
+persistClose()
+{
+    if (!persist_heap)
+    {
+        return;
+    }
+    persist_heap->buckets = bucket_allocator;
+    memcpy(persist_heap->bins, run_allocator.bins, sizeof(persist_heap->bins));
+    memcpy(persist_heap->bin_bits, run_allocator.bin_bits, sizeof(persist_heap->bin_bits));
+    persist_heap->wild_start = run_allocator.wild_start;
+    persist_heap->wild_end = run_allocator.wild_end;
+    check_rv(msync(persist_heap, persist_heap->top, MS_SYNC));
+    persist_heap->clean = 1;
+    check_rv(msync(persist_heap, PAGE_SIZE, MS_SYNC));
+}
+
+// To store a pointer in the given root slot of the persistent heap, for the next run to find
+    int
+xmalloc_set_root(int slot, void* ptr)
+{
+    if (!persist_heap)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (slot < 0 || slot >= XMALLOC_PERSIST_ROOTS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&persist_heap->roots[slot], ptr, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// To fetch the pointer in the given root slot of the persistent heap, or null if there is none
+    void*
+xmalloc_get_root(int slot)
+{
+    if (!persist_heap || slot < 0 || slot >= XMALLOC_PERSIST_ROOTS)
+    {
+        return 0;
+    }
+    return __atomic_load_n(&persist_heap->roots[slot], __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,56 @@
+#ifndef SAVED_RUN_H
+#define SAVED_RUN_H
+
+// What a persistent heap (HMALLOC_PERSIST) keeps between runs of a collatz
+// driver: the finished task table of its last run, in a root slot of the
+// driver's own, so a later run with the same TOP needs no work at all.
+//
+// Task tables are passed around as void*, since each driver has its own
+// num_task. With any heap that is not persistent, nothing is ever found
+// and nothing is kept.
+
+#include "xmalloc.h"
+
+typedef struct saved_run {
+    long  top;
+    void* tasks;
+} saved_run;
+
+// The task table an earlier run kept in slot for top, or 0 if there is none.
+// A table kept for another top is freed with drop, given that top, and the
+// slot is cleared.
+static
+void*
+saved_run_find(int slot, long top, void (*drop)(void* tasks, long top))
+{
+    saved_run* saved = xmalloc_get_root(slot);
+    if (!saved) {
+        return 0;
+    }
+    if (saved->top == top) {
+        return saved->tasks;
+    }
+
+    drop(saved->tasks, saved->top);
+    xfree(saved);
+    xmalloc_set_root(slot, 0);
+    return 0;
+}
+
+// Keep tasks in slot for the next run. Returns 1 if the heap now owns the
+// table, or 0 if it is not persistent and the caller must free it.
+static
+int
+saved_run_keep(int slot, long top, void* tasks)
+{
+    saved_run* saved = xmalloc(sizeof(saved_run));
+    saved->top   = top;
+    saved->tasks = tasks;
+    if (xmalloc_set_root(slot, saved) == -1) {
+        xfree(saved);
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,233 @@
+
+// Hands linked lists from a producer process to a consumer two ways:
+//
+//  - copy: the producer builds each list with xmalloc and writes its items
+//    down a pipe; the consumer rebuilds the list with xmalloc, sums it and
+//    frees it.
+//  - shm:  the producer builds each list in a shared shmheap with offset
+//    links and writes only the head's offset down the pipe; the consumer
+//    sums the list in place and frees its cells back into the shared heap.
+//
+// Usage: shmbench [LISTS [LENGTH]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "xmalloc.h"
+#include "list.h"
+#include "shmheap.h"
+
+#define LISTS  10000
+#define LENGTH 100
+
+// A list cell that is valid in every process mapping the heap
+typedef struct shm_cell {
+    long      item;
+    shm_off_t rest;
+} shm_cell;
+
+static long lists  = LISTS;
+static long length = LENGTH;
+
+static
+double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static
+void
+write_all(int fd, const void* buf, size_t bytes)
+{
+    const char* pos = buf;
+    while (bytes) {
+        ssize_t nn = write(fd, pos, bytes);
+        assert(nn > 0);
+        pos += nn;
+        bytes -= nn;
+    }
+}
+
+static
+int
+read_all(int fd, void* buf, size_t bytes)
+{
+    char* pos = buf;
+    while (bytes) {
+        ssize_t nn = read(fd, pos, bytes);
+        if (nn <= 0) {
+            return 0;
+        }
+        pos += nn;
+        bytes -= nn;
+    }
+    return 1;
+}
+
+static
+void
+copy_producer(int fd)
+{
+    long items[length];
+    for (long ll = 0; ll < lists; ++ll) {
+        cell* xs = 0;
+        for (long ii = 0; ii < length; ++ii) {
+            xs = cons(ll + ii, xs);
+        }
+
+        long nn = 0;
+        for (cell* ys = xs; ys; ys = ys->rest) {
+            items[nn++] = ys->item;
+        }
+        write_all(fd, &nn, sizeof(nn));
+        write_all(fd, items, nn * sizeof(long));
+        free_list(xs);
+    }
+}
+
+static
+long
+copy_consumer(int fd)
+{
+    long items[length];
+    long sum = 0;
+    long nn;
+    while (read_all(fd, &nn, sizeof(nn))) {
+        assert(nn <= length);
+        read_all(fd, items, nn * sizeof(long));
+
+        cell* xs = 0;
+        for (long ii = nn - 1; ii >= 0; --ii) {
+            xs = cons(items[ii], xs);
+        }
+        for (cell* ys = xs; ys; ys = ys->rest) {
+            sum += ys->item;
+        }
+        free_list(xs);
+    }
+    return sum;
+}
+
+static
+void
+shm_producer(shm_heap* heap, int fd)
+{
+    for (long ll = 0; ll < lists; ++ll) {
+        shm_off_t xs = 0;
+        for (long ii = 0; ii < length; ++ii) {
+            shm_cell* cc = shmheap_alloc(heap, sizeof(shm_cell));
+            assert(cc);
+            cc->item = ll + ii;
+            cc->rest = xs;
+            xs = shmheap_off(heap, cc);
+        }
+        write_all(fd, &xs, sizeof(xs));
+    }
+}
+
+static
+long
+shm_consumer(shm_heap* heap, int fd)
+{
+    long sum = 0;
+    shm_off_t xs;
+    while (read_all(fd, &xs, sizeof(xs))) {
+        while (xs) {
+            shm_cell* cc = shmheap_ptr(heap, xs);
+            sum += cc->item;
+            xs = cc->rest;
+            shmheap_free(heap, cc);
+        }
+    }
+    return sum;
+}
+
+// Run one mode, returning the consumer's sum
+static
+long
+run(int shm, double* secs)
+{
+    shm_heap heap;
+    if (shm) {
+        // room for every list at once, in case the consumer falls behind
+        size_t bytes = lists * length * sizeof(shm_cell) * 2 + (1 << 20);
+        if (shmheap_create(&heap, bytes) == -1) {
+            perror("shmheap_create");
+            exit(1);
+        }
+    }
+
+    int pipefd[2];
+    int rv = pipe(pipefd);
+    assert(rv == 0);
+
+    double t0 = now_seconds();
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        close(pipefd[0]);
+        if (shm) {
+            shm_producer(&heap, pipefd[1]);
+        }
+        else {
+            copy_producer(pipefd[1]);
+        }
+        close(pipefd[1]);
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    long sum = shm ? shm_consumer(&heap, pipefd[0]) : copy_consumer(pipefd[0]);
+    close(pipefd[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    *secs = now_seconds() - t0;
+    if (shm) {
+        shmheap_detach(&heap);
+    }
+    return sum;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc > 3) {
+        printf("Usage:\n");
+        printf("\t%s [LISTS [LENGTH]]\n", argv[0]);
+        return 1;
+    }
+
+    lists  = (argc > 1) ? atol(argv[1]) : LISTS;
+    length = (argc > 2) ? atol(argv[2]) : LENGTH;
+    if (lists < 1 || length < 1) {
+        printf("LISTS and LENGTH must be at least 1\n");
+        return 1;
+    }
+
+    // each list sums to length * ll + length * (length - 1) / 2
+    long expect = length * (lists * (lists - 1) / 2) + lists * (length * (length - 1) / 2);
+
+    double copy_secs, shm_secs;
+    long copy_sum = run(0, &copy_secs);
+    long shm_sum  = run(1, &shm_secs);
+
+    if (copy_sum != expect || shm_sum != expect) {
+        printf("sum mismatch: copy=%ld shm=%ld expected=%ld\n", copy_sum, shm_sum, expect);
+        return 1;
+    }
+
+    printf("result mode=copy lists=%ld length=%ld secs=%.4f\n", lists, length, copy_secs);
+    printf("result mode=shm lists=%ld length=%ld secs=%.4f\n", lists, length, shm_secs);
+    return 0;
+}
@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmheap.h"
+
+#define SHM_MAGIC "HMSHEAP2"
+#define SHM_PAGE  4096
+
+// Freed large blocks up to this many pages are kept whole for reuse
+#define SHM_LARGE_PAGES 32
+
+// Chunk sizes per class; 1008 and 2016 divide a page's chunk space exactly
+#define SHM_NUM_CLASSES 12
+static const uint32_t shm_class_sizes[SHM_NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 1008, 2016
+};
+
+// Page 0 of the heap holds this header, and the pages after it the tails
+// bitmap; every page from page_start on starts with a shm_page, unless it is
+// inside a large block
+typedef struct shm_header {
+    char      magic[8];
+    uint64_t  size;
+    // offset of the bitmap with a bit per page, set for the pages of a large
+    // block after its first, so shmheap_free can reject pointers into them
+    shm_off_t tails;
+    // offset of the first page that can be handed out
+    uint64_t  page_start;
+    // offset of the first page never handed out
+    uint64_t  page_top;
+    // stack of freed pages: a generation tag in the high 32 bits, a page number below
+    uint64_t  free_pages;
+    // freed large blocks of each length in pages, as stacks like free_pages
+    uint64_t  free_blocks[SHM_LARGE_PAGES + 1];
+    // offset of the newest page of each class; pages are only ever added
+    shm_off_t classes[SHM_NUM_CLASSES];
+    // a page of each class that last had a chunk freed, tried before the list
+    shm_off_t avail[SHM_NUM_CLASSES];
+    shm_off_t roots[SHMHEAP_ROOTS];
+} shm_header;
+
+typedef struct shm_page {
+    uint32_t  chunk_size;  // 0 for a large block
+    uint32_t  num_chunks;  // a large block's length in pages
+    shm_off_t next;        // the next page of the class, or of the free stack
+    uint64_t  bits[4];     // a set bit marks an allocated chunk
+    uint64_t  pad[2];
+} shm_page;
+
+#define SHM_PAGE_HEADER ((uint64_t)sizeof(shm_page))
+
+static
+shm_header*
+shm_hdr(shm_heap* heap)
+{
+    return (shm_header*)heap->base;
+}
+
+static
+shm_page*
+shm_page_at(shm_heap* heap, shm_off_t off)
+{
+    return (shm_page*)(heap->base + off);
+}
+
+static
+uint64_t*
+shm_tails(shm_heap* heap)
+{
+    return (uint64_t*)(heap->base + shm_hdr(heap)->tails);
+}
+
+// Set or clear the tails bits of every page of a large block but its first
+static
+void
+shm_mark_tails(shm_heap* heap, shm_off_t off, uint64_t npages, int set)
+{
+    uint64_t* tails = shm_tails(heap);
+    for (uint64_t pp = off / SHM_PAGE + 1; pp < off / SHM_PAGE + npages; ++pp) {
+        uint64_t mask = 1ULL << (pp % 64);
+        if (set) {
+            __atomic_fetch_or(&tails[pp / 64], mask, __ATOMIC_RELAXED);
+        }
+        else {
+            __atomic_fetch_and(&tails[pp / 64], ~mask, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+int
+shmheap_create(shm_heap* heap, size_t bytes)
+{
+    size_t size = (bytes + SHM_PAGE - 1) & ~((size_t)SHM_PAGE - 1);
+    if (size / SHM_PAGE > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    // the header page, then the tails bitmap, then at least one page to hand out
+    size_t tails_bytes = (size / SHM_PAGE + 63) / 64 * sizeof(uint64_t);
+    size_t page_start  = SHM_PAGE + ((tails_bytes + SHM_PAGE - 1) & ~((size_t)SHM_PAGE - 1));
+    if (size <= page_start) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = memfd_create("shmheap", MFD_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return -1;
+    }
+    char* base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    // the file starts zeroed, so only the non-zero fields need setting
+    shm_header* hdr = (shm_header*)base;
+    hdr->size       = size;
+    hdr->tails      = SHM_PAGE;
+    hdr->page_start = page_start;
+    hdr->page_top   = page_start;
+    memcpy(hdr->magic, SHM_MAGIC, sizeof(hdr->magic));
+
+    heap->base = base;
+    heap->size = size;
+    heap->fd   = fd;
+    return 0;
+}
+
+int
+shmheap_attach(shm_heap* heap, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    char* base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(((shm_header*)base)->magic, SHM_MAGIC, 8) != 0) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    heap->base = base;
+    heap->size = st.st_size;
+    heap->fd   = fd;
+    return 0;
+}
+
+void
+shmheap_detach(shm_heap* heap)
+{
+    munmap(heap->base, heap->size);
+    close(heap->fd);
+    heap->base = 0;
+    heap->fd   = -1;
+}
+
+shm_off_t*
+shmheap_root(shm_heap* heap, int slot)
+{
+    if (slot < 0 || slot >= SHMHEAP_ROOTS) {
+        errno = EINVAL;
+        return 0;
+    }
+    return &(shm_hdr(heap)->roots[slot]);
+}
+
+// Push a page onto a free stack
+static
+void
+shm_push(shm_heap* heap, uint64_t* stack, shm_off_t off)
+{
+    uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    do {
+        shm_page_at(heap, off)->next = (head & UINT32_MAX) * SHM_PAGE;
+        next = ((head >> 32) + 1) << 32 | (off / SHM_PAGE);
+    } while (!__atomic_compare_exchange_n(stack, &head, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+// Pop a page from a free stack, or 0 if it is empty
+static
+shm_off_t
+shm_pop(shm_heap* heap, uint64_t* stack)
+{
+    uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    while (head & UINT32_MAX) {
+        shm_off_t off = (head & UINT32_MAX) * SHM_PAGE;
+        // the tag changes on every push and pop, so a page popped and pushed
+        // back by another process in between makes this exchange fail
+        uint64_t next = ((head >> 32) + 1) << 32 | (shm_page_at(heap, off)->next / SHM_PAGE);
+        if (__atomic_compare_exchange_n(stack, &head, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return off;
+        }
+    }
+    return 0;
+}
+
+// Take npages never used before, or 0 if the heap is full
+static
+shm_off_t
+shm_take_fresh(shm_heap* heap, uint64_t npages)
+{
+    shm_header* hdr = shm_hdr(heap);
+    uint64_t top = __atomic_load_n(&hdr->page_top, __ATOMIC_RELAXED);
+    do {
+        if (npages == 0 || top > hdr->size || npages > (hdr->size - top) / SHM_PAGE) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&hdr->page_top, &top, top + npages * SHM_PAGE, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return top;
+}
+
+// Take one page: a freed one if any, else a fresh one
+static
+shm_off_t
+shm_take_page(shm_heap* heap)
+{
+    shm_off_t off = shm_pop(heap, &shm_hdr(heap)->free_pages);
+    return off ? off : shm_take_fresh(heap, 1);
+}
+
+// Claim a free chunk in the page, returning its index or -1 if the page is full
+static
+long
+shm_claim(shm_page* page)
+{
+    for (uint32_t ww = 0; ww * 64 < page->num_chunks; ++ww) {
+        uint64_t valid = page->num_chunks - ww * 64 >= 64 ? ~0ULL : (1ULL << (page->num_chunks - ww * 64)) - 1;
+        uint64_t old = __atomic_load_n(&page->bits[ww], __ATOMIC_RELAXED);
+        while (~old & valid) {
+            long bit = __builtin_ctzll(~old & valid);
+            if (__atomic_compare_exchange_n(&page->bits[ww], &old, old | (1ULL << bit), 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return ww * 64 + bit;
+            }
+        }
+    }
+    return -1;
+}
+
+static
+void*
+shm_alloc_large(shm_heap* heap, size_t bytes)
+{
+    // also keeps the page count below from wrapping
+    if (bytes > heap->size) {
+        return 0;
+    }
+    uint64_t npages = (SHM_PAGE_HEADER + bytes + SHM_PAGE - 1) / SHM_PAGE;
+    shm_off_t off = 0;
+    if (npages <= SHM_LARGE_PAGES) {
+        off = shm_pop(heap, &shm_hdr(heap)->free_blocks[npages]);
+    }
+    if (!off) {
+        off = shm_take_fresh(heap, npages);
+    }
+    if (!off) {
+        return 0;
+    }
+    shm_page* page = shm_page_at(heap, off);
+    page->chunk_size = 0;
+    page->num_chunks = npages;
+    shm_mark_tails(heap, off, npages, 1);
+    return (char*)page + SHM_PAGE_HEADER;
+}
+
+// The smallest class that holds bytes, or SHM_NUM_CLASSES if none does
+static
+int
+shm_class_of(size_t bytes)
+{
+    int cls = 0;
+    while (cls < SHM_NUM_CLASSES && shm_class_sizes[cls] < bytes) {
+        cls++;
+    }
+    return cls;
+}
+
+void*
+shmheap_alloc(shm_heap* heap, size_t bytes)
+{
+    int cls = shm_class_of(bytes);
+    if (cls == SHM_NUM_CLASSES) {
+        return shm_alloc_large(heap, bytes);
+    }
+
+    // first try the page that last had a free, then the newest page,
+    // then every page the class has
+    shm_header* hdr = shm_hdr(heap);
+    shm_off_t avail = __atomic_load_n(&hdr->avail[cls], __ATOMIC_ACQUIRE);
+    shm_off_t first = __atomic_load_n(&hdr->classes[cls], __ATOMIC_ACQUIRE);
+    shm_off_t tries[2] = { avail, first };
+    for (int ii = 0; ii < 2; ++ii) {
+        if (tries[ii]) {
+            shm_page* page = shm_page_at(heap, tries[ii]);
+            long idx = shm_claim(page);
+            if (idx >= 0) {
+                return (char*)page + SHM_PAGE_HEADER + idx * page->chunk_size;
+            }
+        }
+    }
+    for (shm_off_t off = first; off != 0; off = shm_page_at(heap, off)->next) {
+        shm_page* page = shm_page_at(heap, off);
+        long idx = shm_claim(page);
+        if (idx >= 0) {
+            return (char*)page + SHM_PAGE_HEADER + idx * page->chunk_size;
+        }
+    }
+
+    // then add a page with its first chunk already claimed
+    shm_off_t off = shm_take_page(heap);
+    if (!off) {
+        return 0;
+    }
+    shm_page* page = shm_page_at(heap, off);
+    memset(page, 0, sizeof(shm_page));
+    page->chunk_size = shm_class_sizes[cls];
+    page->num_chunks = (SHM_PAGE - SHM_PAGE_HEADER) / page->chunk_size;
+    page->bits[0]    = 1;
+
+    page->next = first;
+    while (!__atomic_compare_exchange_n(&hdr->classes[cls], &page->next, off, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
+    return (char*)page + SHM_PAGE_HEADER;
+}
+
+static
+void
+shm_bad_pointer(void* ptr)
+{
+    fprintf(stderr, "shmheap_free: invalid pointer %p (not from this heap, or already freed)\n", ptr);
+    abort();
+}
+
+void
+shmheap_free(shm_heap* heap, void* ptr)
+{
+    shm_off_t at = shmheap_off(heap, ptr);
+    if (at < shm_hdr(heap)->page_start + SHM_PAGE_HEADER || at >= heap->size) {
+        shm_bad_pointer(ptr);
+    }
+    shm_off_t off = at & ~((shm_off_t)SHM_PAGE - 1);
+    shm_page* page = shm_page_at(heap, off);
+
+    // past the first page of a large block there is no page header, only its data
+    uint64_t pp = off / SHM_PAGE;
+    if (__atomic_load_n(&shm_tails(heap)[pp / 64], __ATOMIC_RELAXED) & (1ULL << (pp % 64))) {
+        shm_bad_pointer(ptr);
+    }
+
+    if (page->chunk_size == 0) {
+        if (at != off + SHM_PAGE_HEADER) {
+            shm_bad_pointer(ptr);
+        }
+        shm_mark_tails(heap, off, page->num_chunks, 0);
+        // blocks past SHM_LARGE_PAGES come back page by page, for the classes
+        if (page->num_chunks <= SHM_LARGE_PAGES) {
+            shm_push(heap, &shm_hdr(heap)->free_blocks[page->num_chunks], off);
+            return;
+        }
+        for (uint64_t ii = 0; ii < page->num_chunks; ++ii) {
+            shm_push(heap, &shm_hdr(heap)->free_pages, off + ii * SHM_PAGE);
+        }
+        return;
+    }
+
+    uint64_t gap = at - off - SHM_PAGE_HEADER;
+    uint64_t idx = gap / page->chunk_size;
+    if (gap % page->chunk_size != 0 || idx >= page->num_chunks) {
+        shm_bad_pointer(ptr);
+    }
+    uint64_t mask = 1ULL << (idx % 64);
+    uint64_t old = __atomic_fetch_and(&page->bits[idx / 64], ~mask, __ATOMIC_RELEASE);
+    if (!(old & mask)) {
+        shm_bad_pointer(ptr);
+    }
+    __atomic_store_n(&shm_hdr(heap)->avail[shm_class_of(page->chunk_size)], off, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,65 @@
+#ifndef SHMHEAP_H
+#define SHMHEAP_H
+
+// A bucket heap in shared memory, for handing object graphs between processes
+// without copying them.
+//
+// The heap lives in a memfd that any number of processes map, each at
+// whatever address it gets. Nothing in the heap holds a raw pointer: links
+// between objects are shm_off_t offsets from the start of the mapping, turned
+// into pointers with shmheap_ptr in each process. Chunks are claimed and
+// released with atomics on the page headers, so no lock is shared between
+// processes and a crashed process cannot leave one held.
+//
+//   producer: cell* xs = shmheap_alloc(&heap, sizeof(cell)); ... write shmheap_off(&heap, xs)
+//   consumer: cell* xs = shmheap_ptr(&heap, off); ... shmheap_free(&heap, xs)
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An offset into the heap; 0 is the null offset
+typedef uint64_t shm_off_t;
+
+// Slots in the heap header for publishing offsets between processes
+#define SHMHEAP_ROOTS 16
+
+// This process's view of a heap
+typedef struct shm_heap {
+    char*  base;
+    size_t size;
+    int    fd;
+} shm_heap;
+
+// Create a heap of bytes (rounded up to whole pages) in a new memfd and map it.
+// Returns 0, or -1 with errno set.
+int   shmheap_create(shm_heap* heap, size_t bytes);
+// Map an existing heap from its memfd, e.g. one inherited across fork or
+// passed over a unix socket. Returns 0, or -1 with errno set.
+int   shmheap_attach(shm_heap* heap, int fd);
+// Unmap the heap and close this process's descriptor for it
+void  shmheap_detach(shm_heap* heap);
+
+// Allocate bytes, 16-byte aligned; returns 0 when the heap is full
+void* shmheap_alloc(shm_heap* heap, size_t bytes);
+// Free a block from shmheap_alloc, from any process that maps the heap
+void  shmheap_free(shm_heap* heap, void* ptr);
+
+// A root slot in the heap header, read and written with __atomic builtins;
+// 0 with errno EINVAL unless 0 <= slot < SHMHEAP_ROOTS
+shm_off_t* shmheap_root(shm_heap* heap, int slot);
+
+static inline
+void*
+shmheap_ptr(shm_heap* heap, shm_off_t off)
+{
+    return off ? heap->base + off : 0;
+}
+
+static inline
+shm_off_t
+shmheap_off(shm_heap* heap, void* ptr)
+{
+    return ptr ? (shm_off_t)((char*)ptr - heap->base) : 0;
+}
+
+#endif
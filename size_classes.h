@@ -0,0 +1,84 @@
+#ifndef SIZE_CLASSES_H
+#define SIZE_CLASSES_H
+
+// Bucket sizes for par_malloc.c, in chunk bytes; chunks carry no header.
+// Each must be a multiple of 16, so every chunk is XMALLOC_ALIGNMENT aligned.
+//
+// These are the hand-derived defaults, one bucket per allocation size the
+// collatz drivers make. `make pgo` profiles the drivers and overwrites this
+// file with classes generated by gen_classes; check that in or
+// `git checkout size_classes.h` to go back.
+
+#define BUCKET_NUM_BUCKETS 11
+
+// The size of a linked list node allocation AND tasks[ii]
+//                                 (16 = sizeof(cell))
+//                                 (16 = sizeof(num_task))
+#define BUCKET_LINKED_LIST_CELL 16
+
+// The size of ivec->data when ivec->cap == 4 AND an empty ivec
+//                            (32 = sizeof(long) * 4)
+//                            (32 = sizeof(ivec))
+#define BUCKET_IVEC_DATA_4 32
+
+// The size of ivec->data when ivec->cap == 8 AND an ivec holding 4 items inline
+// AND an unrolled list block
+//                            (64 = sizeof(long) * 8)
+//                            (64 = sizeof(ivec) + sizeof(long) * 4)
+//                            (64 = sizeof(ublock))
+#define BUCKET_IVEC_DATA_8 64
+
+// The size of ivec->data when ivec->cap == 16
+//                             (128 = sizeof(long) * 16)
+#define BUCKET_IVEC_DATA_16 128
+
+// The size of ivec->data when ivec->cap == 32
+//                             (256 = sizeof(long) * 32)
+#define BUCKET_IVEC_DATA_32 256
+
+// The size of ivec->data when ivec->cap == 64
+//                             (512 = sizeof(long) * 64)
+#define BUCKET_IVEC_DATA_64 512
+
+// The size of tasks when data_top = 100 (this is the case for some tests)
+//       (sizeof(num_tasks*)) = 8;  800 = 8 * data_top
+#define BUCKET_TASKS_DATATOP100 800
+
+// The size of ivec->data when ivec->cap == 128
+//                              (1024 = sizeof(long) * 128)
+#define BUCKET_IVEC_DATA_128 1024
+
+// The size of ivec->data when ivec->cap == 256
+//                              (2048 = sizeof(long) * 256)
+#define BUCKET_IVEC_DATA_256 2048
+
+// The size of ivec->data when ivec->cap == 512
+//                              (4096 = sizeof(long) * 512)
+#define BUCKET_IVEC_DATA_512 4096
+
+// The size of ivec->data when ivec->cap == 1024
+//                              (8192 = sizeof(long) * 1024)
+#define BUCKET_IVEC_DATA_1024 8192
+
+// The classes by index, for compile-time dispatch in xmalloc_fast.h
+#define BUCKET_CLASS_0 (BUCKET_LINKED_LIST_CELL)
+#define BUCKET_CLASS_1 (BUCKET_IVEC_DATA_4)
+#define BUCKET_CLASS_2 (BUCKET_IVEC_DATA_8)
+#define BUCKET_CLASS_3 (BUCKET_IVEC_DATA_16)
+#define BUCKET_CLASS_4 (BUCKET_IVEC_DATA_32)
+#define BUCKET_CLASS_5 (BUCKET_IVEC_DATA_64)
+#define BUCKET_CLASS_6 (BUCKET_TASKS_DATATOP100)
+#define BUCKET_CLASS_7 (BUCKET_IVEC_DATA_128)
+#define BUCKET_CLASS_8 (BUCKET_IVEC_DATA_256)
+#define BUCKET_CLASS_9 (BUCKET_IVEC_DATA_512)
+#define BUCKET_CLASS_10 (BUCKET_IVEC_DATA_1024)
+
+// Anything above the last class is served from page runs, or mmap directly past 1 MiB
+
+#define BUCKET_CLASS_SIZES {                                                                   \
+    BUCKET_LINKED_LIST_CELL,    BUCKET_IVEC_DATA_4,     BUCKET_IVEC_DATA_8,     BUCKET_IVEC_DATA_16, \
+    BUCKET_IVEC_DATA_32,        BUCKET_IVEC_DATA_64,    BUCKET_TASKS_DATATOP100, BUCKET_IVEC_DATA_128, \
+    BUCKET_IVEC_DATA_256,       BUCKET_IVEC_DATA_512,   BUCKET_IVEC_DATA_1024 \
+}
+
+#endif
@@ -0,0 +1,254 @@
+
+// Summarizes a heap snapshot written by xmalloc_snapshot (see hmsnap.h).
+//
+// Prints the utilization of each par size class or hw7 arena, a histogram
+// of slab occupancy, and how much resident memory purging free pages
+// (madvise MADV_DONTNEED) could give back without moving anything.
+//
+// Usage: snapstat SNAPSHOT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hmsnap.h"
+
+#define MAX_CLASSES 64
+#define MAX_OWNERS 256
+#define HIST_BINS 6
+
+typedef struct class_stats {
+    uint32_t chunk_size;
+    long     slabs;
+    long     chunks;
+    long     used;
+    long     bytes;
+} class_stats;
+
+static class_stats classes[MAX_CLASSES];
+static int         class_count = 0;
+
+// slabs by occupancy: empty, up to 25%, 50%, 75%, under 100%, full
+static long        hist[HIST_BINS];
+static const char* hist_names[HIST_BINS] = { "0%", "1-25%", "26-50%", "51-75%", "76-99%", "100%" };
+
+static long arena_mapped[MAX_OWNERS];
+static long arena_free[MAX_OWNERS];
+
+static long run_bytes = 0;
+static long free_run_bytes = 0;
+static long fresh_bytes = 0;
+static long large_bytes = 0;
+static long large_count = 0;
+static long purgeable = 0;
+static long page_size = 4096;
+
+static
+class_stats*
+class_of(uint32_t chunk_size)
+{
+    for (int ii = 0; ii < class_count; ++ii) {
+        if (classes[ii].chunk_size == chunk_size) {
+            return &classes[ii];
+        }
+    }
+    if (class_count == MAX_CLASSES) {
+        fprintf(stderr, "snapstat: more than %d size classes\n", MAX_CLASSES);
+        exit(1);
+    }
+    classes[class_count].chunk_size = chunk_size;
+    return &classes[class_count++];
+}
+
+static
+int
+class_cmp(const void* aa, const void* bb)
+{
+    return (int)((const class_stats*)aa)->chunk_size - (int)((const class_stats*)bb)->chunk_size;
+}
+
+static
+int
+chunk_used(const uint64_t* bitmap, long ii)
+{
+    return (bitmap[ii / 64] >> (ii % 64)) & 1;
+}
+
+// whole pages inside [start, end)
+static
+long
+pages_within(uint64_t start, uint64_t end)
+{
+    uint64_t lo = (start + page_size - 1) / page_size;
+    uint64_t hi = end / page_size;
+    return hi > lo ? (long)(hi - lo) : 0;
+}
+
+static
+void
+add_slab(const hmsnap_record* rec, const uint64_t* bitmap)
+{
+    class_stats* cs = class_of(rec->chunk_size);
+    cs->slabs++;
+    cs->chunks += rec->chunks;
+    cs->used   += rec->used;
+    cs->bytes  += rec->bytes;
+
+    int bin;
+    if (rec->used == 0) {
+        bin = 0;
+    }
+    else if (rec->used == rec->chunks) {
+        bin = HIST_BINS - 1;
+    }
+    else {
+        bin = 1 + (int)((rec->used - 1) * 4 / rec->chunks);
+    }
+    hist[bin]++;
+
+    // the header's page stays; any other page whose chunks are all free can go
+    long npages = rec->bytes / page_size;
+    uint64_t header_page = rec->first / page_size;
+    for (long pp = 0; pp < npages; ++pp) {
+        if ((uint64_t)pp == header_page && rec->used) {
+            continue;
+        }
+        uint64_t lo = pp * page_size;
+        uint64_t hi = lo + page_size;
+        int busy = 0;
+        for (long ii = 0; ii < rec->chunks && !busy; ++ii) {
+            uint64_t cs_lo = rec->first + ii * (uint64_t)rec->chunk_size;
+            uint64_t cs_hi = cs_lo + rec->chunk_size;
+            if (cs_lo < hi && cs_hi > lo && chunk_used(bitmap, ii)) {
+                busy = 1;
+            }
+        }
+        if (!busy) {
+            purgeable += page_size;
+        }
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        printf("Usage:\n");
+        printf("\t%s SNAPSHOT\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(hmsnap_header)) {
+        fprintf(stderr, "%s: cannot read snapshot\n", argv[1]);
+        return 1;
+    }
+    char* base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    hmsnap_header* hdr = (hmsnap_header*)base;
+    if (memcmp(hdr->magic, HMSNAP_MAGIC, sizeof(hdr->magic)) != 0) {
+        fprintf(stderr, "%s: not a heap snapshot\n", argv[1]);
+        return 1;
+    }
+    page_size = hdr->page_size;
+
+    char* pos = base + sizeof(hmsnap_header);
+    char* end = base + st.st_size;
+    for (uint64_t nn = 0; nn < hdr->count; ++nn) {
+        hmsnap_record* rec = (hmsnap_record*)pos;
+        if (pos + sizeof(*rec) > end) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return 1;
+        }
+        pos += sizeof(*rec);
+
+        switch (rec->kind) {
+        case HMSNAP_SLAB: {
+            const uint64_t* bitmap = (const uint64_t*)pos;
+            pos += (rec->chunks + 63) / 64 * sizeof(uint64_t);
+            if (pos > end) {
+                fprintf(stderr, "%s: truncated\n", argv[1]);
+                return 1;
+            }
+            add_slab(rec, bitmap);
+            break;
+        }
+        case HMSNAP_RUN:
+            run_bytes += rec->bytes;
+            break;
+        case HMSNAP_FREE_RUN:
+            if (rec->flags & HMSNAP_FRESH) {
+                fresh_bytes += rec->bytes;
+            }
+            else {
+                free_run_bytes += rec->bytes;
+                purgeable += rec->bytes;
+            }
+            break;
+        case HMSNAP_LARGE:
+            large_bytes += rec->bytes;
+            large_count += rec->used;
+            break;
+        case HMSNAP_ARENA:
+            arena_mapped[rec->owner] += rec->bytes;
+            break;
+        case HMSNAP_FREE_CELL:
+            arena_free[rec->owner] += rec->bytes;
+            if (rec->flags & HMSNAP_FRESH) {
+                fresh_bytes += rec->bytes;
+            }
+            else {
+                // the cell header on the first page has to stay
+                purgeable += pages_within(rec->addr + 16, rec->addr + rec->bytes) * page_size;
+            }
+            break;
+        default:
+            fprintf(stderr, "%s: unknown record kind %d\n", argv[1], rec->kind);
+            return 1;
+        }
+    }
+
+    printf("snapshot allocator=%.8s records=%lu\n", hdr->allocator, hdr->count);
+
+    if (class_count) {
+        qsort(classes, class_count, sizeof(class_stats), class_cmp);
+        printf("\n%8s %8s %10s %10s %8s %10s\n", "class", "slabs", "chunks", "used", "util", "kb");
+        for (int ii = 0; ii < class_count; ++ii) {
+            class_stats* cs = &classes[ii];
+            printf("%8u %8ld %10ld %10ld %7.1f%% %10ld\n", cs->chunk_size, cs->slabs, cs->chunks, cs->used,
+                   cs->chunks ? 100.0 * cs->used / cs->chunks : 0.0, cs->bytes / 1024);
+        }
+        printf("\nslab occupancy:");
+        for (int ii = 0; ii < HIST_BINS; ++ii) {
+            printf(" %s=%ld", hist_names[ii], hist[ii]);
+        }
+        printf("\n");
+    }
+
+    int header = 0;
+    for (int ii = 0; ii < MAX_OWNERS; ++ii) {
+        if (!arena_mapped[ii] && !arena_free[ii]) {
+            continue;
+        }
+        if (!header) {
+            printf("\n%8s %10s %10s %8s\n", "arena", "mapped_kb", "free_kb", "util");
+            header = 1;
+        }
+        printf("%8d %10ld %10ld %7.1f%%\n", ii, arena_mapped[ii] / 1024, arena_free[ii] / 1024,
+               arena_mapped[ii] ? 100.0 * (arena_mapped[ii] - arena_free[ii]) / arena_mapped[ii] : 0.0);
+    }
+
+    printf("\nruns_kb=%ld free_runs_kb=%ld untouched_kb=%ld large_kb=%ld large_count=%ld\n",
+           run_bytes / 1024, free_run_bytes / 1024, fresh_bytes / 1024, large_bytes / 1024, large_count);
+    printf("purgeable_kb=%ld\n", purgeable / 1024);
+
+    return 0;
+}
@@ -1,26 +1,115 @@
 
 
 #include <stdlib.h>
+#include <malloc.h>
+#include <errno.h>
 #include <unistd.h>
 
 #include "xmalloc.h"
+#include "xtrace.h"
 
 
 void*
 xmalloc(size_t bytes)
 {
-    return malloc(bytes);
+    void* ptr = malloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+void*
+xcalloc(size_t nmemb, size_t bytes)
+{
+    void* ptr = calloc(nmemb, bytes);
+    XTRACE(xtrace_alloc(XTRACE_CALLOC, ptr, nmemb * bytes));
+    return ptr;
+}
+
+void*
+xmalloc_hint(size_t bytes, int flags)
+{
+    // the system allocator has no use for lifetime hints
+    void* ptr = malloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
 }
 
 void
 xfree(void* ptr)
 {
+    XTRACE(xtrace_free(ptr));
+    free(ptr);
+}
+
+void
+xfree_sized(void* ptr, size_t bytes)
+{
+    // malloc looks the size up itself
+    XTRACE(xtrace_free(ptr));
     free(ptr);
 }
 
 void*
 xrealloc(void* prev, size_t bytes)
 {
-    return realloc(prev, bytes);
+    uint32_t old_id = 0;
+    XTRACE(old_id = xtrace_realloc_begin(prev));
+    void* ptr = realloc(prev, bytes);
+    XTRACE(xtrace_realloc_end(old_id, ptr, bytes));
+    return ptr;
+}
+
+size_t
+xmalloc_usable_size(void* ptr)
+{
+    return malloc_usable_size(ptr);
+}
+
+void*
+xmalloc_at_least(size_t bytes, size_t* actual)
+{
+    void* ptr = malloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    if (actual) {
+        *actual = malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void*
+xmalloc_class(int cls, size_t bytes, int hint)
+{
+    // size classes are par's; the size is all malloc needs
+    void* ptr = malloc(bytes);
+    XTRACE(xtrace_alloc(XTRACE_MALLOC, ptr, bytes));
+    return ptr;
+}
+
+void
+xfree_class(void* ptr)
+{
+    XTRACE(xtrace_free(ptr));
+    free(ptr);
 }
 
+int
+xmalloc_snapshot(const char* path)
+{
+    // glibc's heap layout is not ours to walk
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+xmalloc_set_root(int slot, void* ptr)
+{
+    // malloc's heap does not outlive the process
+    errno = ENOSYS;
+    return -1;
+}
+
+void*
+xmalloc_get_root(int slot)
+{
+    return 0;
+}
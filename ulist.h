@@ -0,0 +1,107 @@
+#ifndef ULIST_H
+#define ULIST_H
+
+#include <string.h>
+
+#include "xmalloc_fast.h"
+
+// Items per block: a block is one 64-byte cache line
+#define ULIST_BLOCK 6
+
+// Unrolled linked list: each block holds up to ULIST_BLOCK items, packed at
+// the end of items[], so the list's first item is items[first] of its first
+// block. Only the first block is ever partly empty.
+//
+// There is no sharing cons: ucons_owned writes into the first block when it
+// has room, so it changes rest in place. Only use it on a list nothing else
+// refers to, and use the list it returns instead of rest from then on.
+typedef struct ublock {
+    struct ublock* rest;
+    long           first;
+    long           items[ULIST_BLOCK];
+} ublock;
+
+// Prepend item to a list the caller owns outright
+// hint is one of the XMALLOC_HINT_* lifetime hints
+static
+ublock*
+ucons_owned_hint(long item, ublock* rest, int hint)
+{
+    if (rest && rest->first > 0) {
+        rest->first -= 1;
+        rest->items[rest->first] = item;
+        return rest;
+    }
+
+    ublock* xs = xmalloc_fast(sizeof(ublock), hint);
+    xs->rest  = rest;
+    xs->first = ULIST_BLOCK - 1;
+    xs->items[xs->first] = item;
+    return xs;
+}
+
+static
+ublock*
+ucons_owned(long item, ublock* rest)
+{
+    return ucons_owned_hint(item, rest, XMALLOC_HINT_DEFAULT);
+}
+
+static
+long
+ulist_head(ublock* xs)
+{
+    return xs->items[xs->first];
+}
+
+static
+long
+count_ulist(ublock* xs)
+{
+    long nn = 0;
+    while (xs) {
+        nn += ULIST_BLOCK - xs->first;
+        xs = xs->rest;
+    }
+    return nn;
+}
+
+static
+void
+free_ulist(ublock* xs)
+{
+    while (xs) {
+        ublock* ys = xs->rest;
+        xfree_fast(xs, sizeof(ublock));
+        xs = ys;
+    }
+}
+
+// Copy block by block, front to back, keeping each block's layout;
+// hint is one of the XMALLOC_HINT_* lifetime hints
+static
+ublock*
+copy_ulist_hint(ublock* xs, int hint)
+{
+    ublock*  ys   = 0;
+    ublock** tail = &ys;
+    while (xs) {
+        ublock* zs = xmalloc_fast(sizeof(ublock), hint);
+        zs->first = xs->first;
+        memcpy(zs->items + xs->first, xs->items + xs->first, (ULIST_BLOCK - xs->first) * sizeof(long));
+        *tail = zs;
+        tail  = &zs->rest;
+        xs    = xs->rest;
+    }
+    *tail = 0;
+    return ys;
+}
+
+static
+ublock*
+copy_ulist(ublock* xs)
+{
+    return copy_ulist_hint(xs, XMALLOC_HINT_DEFAULT);
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef WSDEQUE_H
+#define WSDEQUE_H
+
+// Chase-Lev work-stealing deque of task indices (Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+//
+// The owning thread pushes and pops at the bottom; any other thread steals
+// from the top. Claiming the last item, by a pop or a steal, is a single
+// compare-and-swap on top, so each index goes to exactly one thread.
+//
+// The buffer never grows: make the deque big enough for every index that
+// can be in it at once.
+
+#include <assert.h>
+
+#include "xmalloc.h"
+
+#define WS_EMPTY -1
+
+typedef struct ws_deque {
+    // top and bottom on lines of their own: thieves write one, the owner the other
+    long  top;
+    char  pad0[64 - sizeof(long)];
+    long  bottom;
+    char  pad1[64 - sizeof(long)];
+    long  mask;
+    long* items;
+} ws_deque;
+
+static
+void
+ws_init(ws_deque* dq, long cap)
+{
+    long size = 1;
+    while (size < cap) {
+        size *= 2;
+    }
+    dq->top    = 0;
+    dq->bottom = 0;
+    dq->mask   = size - 1;
+    dq->items  = xmalloc(size * sizeof(long));
+}
+
+static
+void
+ws_destroy(ws_deque* dq)
+{
+    xfree(dq->items);
+}
+
+// Owner only
+static
+void
+ws_push(ws_deque* dq, long item)
+{
+    long bb = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    long tt = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    assert(bb - tt <= dq->mask);
+    __atomic_store_n(&dq->items[bb & dq->mask], item, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, bb + 1, __ATOMIC_RELAXED);
+}
+
+// Owner only: the newest item, or WS_EMPTY
+static
+long
+ws_pop(ws_deque* dq)
+{
+    long bb = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, bb, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long tt = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    long item = WS_EMPTY;
+    if (tt <= bb) {
+        item = __atomic_load_n(&dq->items[bb & dq->mask], __ATOMIC_RELAXED);
+        if (tt == bb) {
+            // the last item: race the thieves for it
+            if (!__atomic_compare_exchange_n(&dq->top, &tt, tt + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                item = WS_EMPTY;
+            }
+            __atomic_store_n(&dq->bottom, bb + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        __atomic_store_n(&dq->bottom, bb + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+// Any thread: the oldest item, or WS_EMPTY if the deque is empty or another thread won it
+static
+long
+ws_steal(ws_deque* dq)
+{
+    long tt = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bb = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if (tt < bb) {
+        long item = __atomic_load_n(&dq->items[tt & dq->mask], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&dq->top, &tt, tt + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return item;
+        }
+    }
+    return WS_EMPTY;
+}
+
+#endif
@@ -3,8 +3,64 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every block is aligned to at least this many bytes, enough for any
+// fundamental type (__STDCPP_DEFAULT_NEW_ALIGNMENT__ on x86-64).
+#define XMALLOC_ALIGNMENT 16
+
 void* xmalloc(size_t bytes);
+void* xcalloc(size_t nmemb, size_t bytes);
 void  xfree(void* ptr);
 void* xrealloc(void* prev, size_t bytes);
 
+// The number of bytes actually usable at ptr, which may exceed the size requested.
+size_t xmalloc_usable_size(void* ptr);
+// Allocate at least bytes, storing the usable capacity in *actual if actual is non-null.
+void*  xmalloc_at_least(size_t bytes, size_t* actual);
+
+// Lifetime hints for xmalloc_hint. Allocators that honour them keep each
+// hint's objects on pages of their own, so pages of short-lived objects
+// empty out together instead of being pinned by one long-lived survivor.
+#define XMALLOC_HINT_DEFAULT     0
+#define XMALLOC_HINT_SHORT_LIVED 1
+#define XMALLOC_HINT_LONG_LIVED  2
+#define XMALLOC_HINT_READ_MOSTLY 3
+#define XMALLOC_NUM_HINTS        4
+
+// Allocate bytes with one of the XMALLOC_HINT_* lifetime hints; free with xfree.
+void* xmalloc_hint(size_t bytes, int flags);
+
+// Free a block of bytes, the size it was allocated with. Passing any other
+// size is undefined. It does the same lookup and checks as xfree; par only
+// uses the size to skip the checks for page runs and direct mappings.
+void  xfree_sized(void* ptr, size_t bytes);
+
+// Entry points for xmalloc_fast.h: allocate bytes, already known to fall in
+// size class cls, or free a block of one of the small size classes. Only
+// xmalloc_class saves work; xfree_class is xfree for small blocks.
+void* xmalloc_class(int cls, size_t bytes, int hint);
+void  xfree_class(void* ptr);
+
+// Write a snapshot of the heap's layout to path for snapstat (see hmsnap.h).
+// Returns 0 on success, or -1 if the file cannot be written or the allocator
+// has nothing to report (sys).
+int   xmalloc_snapshot(const char* path);
+
+// Persistent heap roots. With HMALLOC_PERSIST=file, par keeps its whole heap
+// in that file, mapped at the same address every run, so a later run finds the
+// objects of an earlier one where it left them; the root slots are where it
+// looks first. xmalloc_set_root returns 0, or -1 if the heap is not persistent
+// (sys, hw7, or par without HMALLOC_PERSIST); xmalloc_get_root returns 0 then.
+#define XMALLOC_PERSIST_ROOTS 16
+
+int   xmalloc_set_root(int slot, void* ptr);
+void* xmalloc_get_root(int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
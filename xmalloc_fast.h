@@ -0,0 +1,108 @@
+#ifndef XMALLOC_FAST_H
+#define XMALLOC_FAST_H
+
+// Compile-time size class dispatch.
+//
+// xmalloc_fast and xfree_fast behave like xmalloc_hint and xfree_sized, but
+// when the size is a compile-time constant (sizeof(cell), sizeof(ivec), ...)
+// its par size class is worked out by the compiler, even at -O0, and the
+// call goes straight to xmalloc_class / xfree_class. Other sizes, and
+// constants past the small classes, take the ordinary entry points.
+//
+// Only allocation gains: xmalloc_class skips the size class search, but
+// xfree_class looks the chunk up in the page map just as xfree does.
+//
+// Both are macros: the size argument is only evaluated once at run time.
+
+#include "xmalloc.h"
+#include "size_classes.h"
+
+// The dispatch below is written out for this many classes
+#define XMALLOC_FAST_CLASSES 16
+
+#if BUCKET_NUM_BUCKETS > XMALLOC_FAST_CLASSES
+#error "size_classes.h has more classes than xmalloc_fast.h dispatches on; add BUCKET_CLASS_N cases"
+#endif
+
+#ifndef BUCKET_CLASS_0
+#define BUCKET_CLASS_0 0
+#endif
+#ifndef BUCKET_CLASS_1
+#define BUCKET_CLASS_1 0
+#endif
+#ifndef BUCKET_CLASS_2
+#define BUCKET_CLASS_2 0
+#endif
+#ifndef BUCKET_CLASS_3
+#define BUCKET_CLASS_3 0
+#endif
+#ifndef BUCKET_CLASS_4
+#define BUCKET_CLASS_4 0
+#endif
+#ifndef BUCKET_CLASS_5
+#define BUCKET_CLASS_5 0
+#endif
+#ifndef BUCKET_CLASS_6
+#define BUCKET_CLASS_6 0
+#endif
+#ifndef BUCKET_CLASS_7
+#define BUCKET_CLASS_7 0
+#endif
+#ifndef BUCKET_CLASS_8
+#define BUCKET_CLASS_8 0
+#endif
+#ifndef BUCKET_CLASS_9
+#define BUCKET_CLASS_9 0
+#endif
+#ifndef BUCKET_CLASS_10
+#define BUCKET_CLASS_10 0
+#endif
+#ifndef BUCKET_CLASS_11
+#define BUCKET_CLASS_11 0
+#endif
+#ifndef BUCKET_CLASS_12
+#define BUCKET_CLASS_12 0
+#endif
+#ifndef BUCKET_CLASS_13
+#define BUCKET_CLASS_13 0
+#endif
+#ifndef BUCKET_CLASS_14
+#define BUCKET_CLASS_14 0
+#endif
+#ifndef BUCKET_CLASS_15
+#define BUCKET_CLASS_15 0
+#endif
+
+#define XMALLOC_FITS_CLASS(bytes, ii) \
+    ((ii) < BUCKET_NUM_BUCKETS && (bytes) <= (size_t)(BUCKET_CLASS_##ii))
+
+// The class of a constant size, or -1 if it is larger than every class
+#define XMALLOC_CLASS_OF(bytes) (                   \
+    XMALLOC_FITS_CLASS(bytes, 0)  ? 0  :            \
+    XMALLOC_FITS_CLASS(bytes, 1)  ? 1  :            \
+    XMALLOC_FITS_CLASS(bytes, 2)  ? 2  :            \
+    XMALLOC_FITS_CLASS(bytes, 3)  ? 3  :            \
+    XMALLOC_FITS_CLASS(bytes, 4)  ? 4  :            \
+    XMALLOC_FITS_CLASS(bytes, 5)  ? 5  :            \
+    XMALLOC_FITS_CLASS(bytes, 6)  ? 6  :            \
+    XMALLOC_FITS_CLASS(bytes, 7)  ? 7  :            \
+    XMALLOC_FITS_CLASS(bytes, 8)  ? 8  :            \
+    XMALLOC_FITS_CLASS(bytes, 9)  ? 9  :            \
+    XMALLOC_FITS_CLASS(bytes, 10) ? 10 :            \
+    XMALLOC_FITS_CLASS(bytes, 11) ? 11 :            \
+    XMALLOC_FITS_CLASS(bytes, 12) ? 12 :            \
+    XMALLOC_FITS_CLASS(bytes, 13) ? 13 :            \
+    XMALLOC_FITS_CLASS(bytes, 14) ? 14 :            \
+    XMALLOC_FITS_CLASS(bytes, 15) ? 15 : -1)
+
+#define XMALLOC_IS_FAST(bytes) (__builtin_constant_p(bytes) && XMALLOC_CLASS_OF(bytes) >= 0)
+
+#define xmalloc_fast(bytes, hint)                                        \
+    (XMALLOC_IS_FAST(bytes) ? xmalloc_class(XMALLOC_CLASS_OF(bytes), (bytes), (hint)) \
+                            : xmalloc_hint((bytes), (hint)))
+
+#define xfree_fast(ptr, bytes)                                           \
+    (XMALLOC_IS_FAST(bytes) ? xfree_class((ptr))                                \
+                            : xfree_sized((ptr), (bytes)))
+
+#endif
@@ -0,0 +1,215 @@
+
+// Replaces the global operator new and delete with xmalloc and xfree, so
+// every C++ allocation in a program linked with this object goes to the
+// allocator the program is built against.
+//
+// Plain new needs __STDCPP_DEFAULT_NEW_ALIGNMENT__, which xmalloc already
+// gives, so it calls xmalloc directly and sized delete calls xfree_sized.
+// Only alignments past XMALLOC_ALIGNMENT over-allocate and keep the block's
+// start in the word before the aligned pointer.
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "xmalloc.h"
+
+static_assert(__STDCPP_DEFAULT_NEW_ALIGNMENT__ <= XMALLOC_ALIGNMENT,
+              "plain new relies on xmalloc's alignment");
+
+static void*
+xnew(std::size_t bytes)
+{
+    // new of zero bytes must still return a distinct pointer
+    void* ptr = xmalloc(bytes ? bytes : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void*
+xnew_aligned(std::size_t bytes, std::align_val_t align)
+{
+    std::size_t aa = static_cast<std::size_t>(align);
+    if (aa <= XMALLOC_ALIGNMENT) {
+        return xnew(bytes);
+    }
+    if (bytes > SIZE_MAX - aa - sizeof(void*)) {
+        throw std::bad_alloc();
+    }
+    char* base = static_cast<char*>(xnew(bytes + aa + sizeof(void*)));
+    uintptr_t addr = (reinterpret_cast<uintptr_t>(base) + sizeof(void*) + aa - 1) & ~(uintptr_t)(aa - 1);
+    reinterpret_cast<void**>(addr)[-1] = base;
+    return reinterpret_cast<void*>(addr);
+}
+
+static void
+xdelete_aligned(void* ptr, std::align_val_t align)
+{
+    if (!ptr) {
+        return;
+    }
+    if (static_cast<std::size_t>(align) <= XMALLOC_ALIGNMENT) {
+        xfree(ptr);
+        return;
+    }
+    xfree(static_cast<void**>(ptr)[-1]);
+}
+
+static void
+xdelete_aligned_sized(void* ptr, std::size_t bytes, std::align_val_t align)
+{
+    std::size_t aa = static_cast<std::size_t>(align);
+    if (!ptr) {
+        return;
+    }
+    if (aa <= XMALLOC_ALIGNMENT) {
+        xfree_sized(ptr, bytes ? bytes : 1);
+        return;
+    }
+    // the size xnew_aligned asked xmalloc for
+    xfree_sized(static_cast<void**>(ptr)[-1], bytes + aa + sizeof(void*));
+}
+
+void*
+operator new(std::size_t bytes)
+{
+    return xnew(bytes);
+}
+
+void*
+operator new[](std::size_t bytes)
+{
+    return xnew(bytes);
+}
+
+void*
+operator new(std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return xmalloc(bytes ? bytes : 1);
+}
+
+void*
+operator new[](std::size_t bytes, const std::nothrow_t&) noexcept
+{
+    return xmalloc(bytes ? bytes : 1);
+}
+
+void*
+operator new(std::size_t bytes, std::align_val_t align)
+{
+    return xnew_aligned(bytes, align);
+}
+
+void*
+operator new[](std::size_t bytes, std::align_val_t align)
+{
+    return xnew_aligned(bytes, align);
+}
+
+void*
+operator new(std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try {
+        return xnew_aligned(bytes, align);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+void*
+operator new[](std::size_t bytes, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try {
+        return xnew_aligned(bytes, align);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+    if (ptr) {
+        xfree(ptr);
+    }
+}
+
+void
+operator delete[](void* ptr) noexcept
+{
+    if (ptr) {
+        xfree(ptr);
+    }
+}
+
+void
+operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    if (ptr) {
+        xfree(ptr);
+    }
+}
+
+void
+operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    if (ptr) {
+        xfree(ptr);
+    }
+}
+
+void
+operator delete(void* ptr, std::size_t bytes) noexcept
+{
+    if (ptr) {
+        xfree_sized(ptr, bytes ? bytes : 1);
+    }
+}
+
+void
+operator delete[](void* ptr, std::size_t bytes) noexcept
+{
+    if (ptr) {
+        xfree_sized(ptr, bytes ? bytes : 1);
+    }
+}
+
+void
+operator delete(void* ptr, std::align_val_t align) noexcept
+{
+    xdelete_aligned(ptr, align);
+}
+
+void
+operator delete[](void* ptr, std::align_val_t align) noexcept
+{
+    xdelete_aligned(ptr, align);
+}
+
+void
+operator delete(void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    xdelete_aligned(ptr, align);
+}
+
+void
+operator delete[](void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    xdelete_aligned(ptr, align);
+}
+
+void
+operator delete(void* ptr, std::size_t bytes, std::align_val_t align) noexcept
+{
+    xdelete_aligned_sized(ptr, bytes, align);
+}
+
+void
+operator delete[](void* ptr, std::size_t bytes, std::align_val_t align) noexcept
+{
+    xdelete_aligned_sized(ptr, bytes, align);
+}
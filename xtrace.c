@@ -0,0 +1,248 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "xtrace.h"
+
+// Address space reserved for the log; the file itself grows in steps.
+static const size_t TRACE_RESERVE = (size_t)16 << 30;
+static const size_t TRACE_GROW    = (size_t)64 << 20;
+
+// Live pointer -> object id table, open addressed and lock free.
+// Keys are never moved: a freed slot becomes a tombstone until reused.
+#define ID_TABLE_SLOTS ((size_t)1 << 24)
+#define ID_EMPTY 0
+#define ID_TOMB  1
+
+typedef struct id_slot {
+    uintptr_t key;
+    uint32_t  id;
+} id_slot;
+
+int xtrace_enabled = 0;
+
+static int             trace_fd = -1;
+static char*           trace_base = 0;
+static size_t          trace_file_size = 0;
+static uint64_t        trace_next = 0;
+static pthread_mutex_t trace_grow_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t        trace_start_ns = 0;
+
+static id_slot*        id_table = 0;
+static uint32_t        id_next = 0;
+static uint16_t        thread_next = 0;
+
+static __thread uint16_t thread_id = 0;
+
+static
+uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void
+trace_fail(const char* what)
+{
+    perror(what);
+    abort();
+}
+
+static
+size_t
+slot_of(uintptr_t key)
+{
+    // allocations are at least 8-byte aligned; mix the rest
+    uint64_t hh = (key >> 3) * 0x9E3779B97F4A7C15ull;
+    return hh >> (64 - 24);
+}
+
+static
+uint32_t
+id_insert(void* ptr)
+{
+    uint32_t id = __atomic_add_fetch(&id_next, 1, __ATOMIC_RELAXED);
+    uintptr_t key = (uintptr_t)ptr;
+
+    for (size_t nn = 0, ii = slot_of(key); nn < ID_TABLE_SLOTS; ++nn, ii = (ii + 1) & (ID_TABLE_SLOTS - 1)) {
+        uintptr_t old = __atomic_load_n(&id_table[ii].key, __ATOMIC_RELAXED);
+        if (old != ID_EMPTY && old != ID_TOMB) {
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&id_table[ii].key, &old, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&id_table[ii].id, id, __ATOMIC_RELEASE);
+            return id;
+        }
+    }
+
+    fprintf(stderr, "xtrace: more than %zu live objects\n", ID_TABLE_SLOTS);
+    abort();
+}
+
+static
+uint32_t
+id_remove(void* ptr)
+{
+    uintptr_t key = (uintptr_t)ptr;
+
+    for (size_t nn = 0, ii = slot_of(key); nn < ID_TABLE_SLOTS; ++nn, ii = (ii + 1) & (ID_TABLE_SLOTS - 1)) {
+        uintptr_t old = __atomic_load_n(&id_table[ii].key, __ATOMIC_ACQUIRE);
+        if (old == ID_EMPTY) {
+            break;
+        }
+        if (old == key) {
+            uint32_t id = __atomic_load_n(&id_table[ii].id, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&id_table[ii].key, ID_TOMB, __ATOMIC_RELEASE);
+            return id;
+        }
+    }
+
+    // allocated before tracing started
+    return 0;
+}
+
+static
+xtrace_record*
+trace_claim()
+{
+    uint64_t index = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    size_t end = sizeof(xtrace_header) + (index + 1) * sizeof(xtrace_record);
+
+    if (end > __atomic_load_n(&trace_file_size, __ATOMIC_ACQUIRE)) {
+        if (end > TRACE_RESERVE) {
+            fprintf(stderr, "xtrace: trace is larger than %zu bytes\n", TRACE_RESERVE);
+            abort();
+        }
+
+        pthread_mutex_lock(&trace_grow_lock);
+        size_t size = trace_file_size;
+        if (end > size) {
+            while (size < end) {
+                size += TRACE_GROW;
+            }
+            if (ftruncate(trace_fd, size) == -1) {
+                trace_fail("xtrace: ftruncate");
+            }
+            __atomic_store_n(&trace_file_size, size, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&trace_grow_lock);
+    }
+
+    return (xtrace_record*)(trace_base + sizeof(xtrace_header)) + index;
+}
+
+static
+void
+trace_write(int op, size_t bytes, uint32_t id, uint32_t old_id)
+{
+    if (thread_id == 0) {
+        thread_id = __atomic_add_fetch(&thread_next, 1, __ATOMIC_RELAXED);
+    }
+
+    xtrace_record* rec = trace_claim();
+    rec->op      = op;
+    rec->pad     = 0;
+    rec->thread  = thread_id;
+    rec->size    = bytes > UINT32_MAX ? UINT32_MAX : (uint32_t)bytes;
+    rec->id      = id;
+    rec->old_id  = old_id;
+    rec->time_ns = now_ns() - trace_start_ns;
+}
+
+void
+xtrace_alloc(int op, void* ptr, size_t bytes)
+{
+    trace_write(op, bytes, id_insert(ptr), 0);
+}
+
+void
+xtrace_free(void* ptr)
+{
+    if (ptr) {
+        trace_write(XTRACE_FREE, 0, id_remove(ptr), 0);
+    }
+}
+
+uint32_t
+xtrace_realloc_begin(void* prev)
+{
+    return prev ? id_remove(prev) : 0;
+}
+
+void
+xtrace_realloc_end(uint32_t old_id, void* ptr, size_t bytes)
+{
+    trace_write(XTRACE_REALLOC, bytes, id_insert(ptr), old_id);
+}
+
+__attribute__((constructor))
+static
+void
+xtrace_start()
+{
+    const char* path = getenv("HMALLOC_TRACE");
+    if (!path || !*path) {
+        return;
+    }
+
+    trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd == -1) {
+        trace_fail("xtrace: open");
+    }
+    if (ftruncate(trace_fd, TRACE_GROW) == -1) {
+        trace_fail("xtrace: ftruncate");
+    }
+    trace_file_size = TRACE_GROW;
+
+    trace_base = mmap(0, TRACE_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, trace_fd, 0);
+    if (trace_base == MAP_FAILED) {
+        trace_fail("xtrace: mmap");
+    }
+
+    id_table = mmap(0, ID_TABLE_SLOTS * sizeof(id_slot), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (id_table == MAP_FAILED) {
+        trace_fail("xtrace: mmap");
+    }
+
+    trace_start_ns = now_ns();
+    xtrace_enabled = 1;
+}
+
+__attribute__((destructor))
+static
+void
+xtrace_stop()
+{
+    if (!xtrace_enabled) {
+        return;
+    }
+    xtrace_enabled = 0;
+
+    // threads still running past exit may have claimed records they never
+    // filled in; those show up with op 0 and are skipped on replay
+    uint64_t count = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+    size_t size = sizeof(xtrace_header) + count * sizeof(xtrace_record);
+
+    xtrace_header* hdr = (xtrace_header*)trace_base;
+    memcpy(hdr->magic, XTRACE_MAGIC, sizeof(hdr->magic));
+    hdr->count   = count;
+    hdr->threads = thread_next;
+    hdr->objects = id_next;
+
+    // the mapping is left in place for any stragglers; the kernel drops it at exit
+    if (ftruncate(trace_fd, size) == -1) {
+        trace_fail("xtrace: ftruncate");
+    }
+    close(trace_fd);
+}
@@ -0,0 +1,54 @@
+#ifndef XTRACE_H
+#define XTRACE_H
+
+// Allocation tracing for the xmalloc shims.
+//
+// Setting HMALLOC_TRACE=path makes every xmalloc, xcalloc, xfree and xrealloc
+// append a record to path, a memory-mapped binary log. Records carry only the
+// operation, size, thread and an object id, never an address or contents, so
+// a trace can be handed out and re-run with hmreplay against any allocator.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XTRACE_MAGIC "HMTRACE1"
+
+enum {
+    XTRACE_MALLOC  = 1,
+    XTRACE_CALLOC  = 2,
+    XTRACE_FREE    = 3,
+    XTRACE_REALLOC = 4,
+};
+
+// The file starts with this header, followed by count records
+typedef struct xtrace_header {
+    char     magic[8];
+    uint64_t count;
+    uint64_t threads;
+    uint64_t objects;
+} xtrace_header;
+
+typedef struct xtrace_record {
+    uint8_t  op;
+    uint8_t  pad;
+    uint16_t thread;   // 1-based, in order of each thread's first traced call
+    uint32_t size;     // bytes requested, saturating at UINT32_MAX
+    uint32_t id;       // the object allocated or freed; 0 for none
+    uint32_t old_id;   // XTRACE_REALLOC: the object resized
+    uint64_t time_ns;  // since tracing started
+} xtrace_record;
+
+extern int xtrace_enabled;
+
+// Call after the allocation returns
+void xtrace_alloc(int op, void* ptr, size_t bytes);
+// Call before the block is released, so a racing allocation of the same
+// address is always logged after it
+void xtrace_free(void* ptr);
+// Call before the reallocation; pass the result to xtrace_realloc_end
+uint32_t xtrace_realloc_begin(void* prev);
+void xtrace_realloc_end(uint32_t old_id, void* ptr, size_t bytes);
+
+#define XTRACE(call) do { if (__builtin_expect(xtrace_enabled, 0)) { call; } } while (0)
+
+#endif